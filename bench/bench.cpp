@@ -0,0 +1,375 @@
+/**
+ * @file bench.cpp
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Benchmark `xsort` against the C and C++ standard library sorts
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Every measurement runs in a forked child so that its peak resident set
+ * can be attributed to the sort alone. Elements pack a 32-bit key above
+ * their original index, and only the key is compared, which lets each run
+ * be checked for both order and stability.
+ *
+ * Usage: bench [-n max_elements] [-d distribution] [-a algorithm] [-s seed]
+ *
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "xsort.h"
+
+#if defined(__has_include)
+    #if __has_include("pdqsort.h")
+        #include "pdqsort.h"
+        #define BENCH_PDQSORT
+    #endif
+#endif
+
+// Aim for at least this many elements sorted per timed batch, so small
+// sizes are not dominated by clock overhead
+#define BENCH_BATCH_ELEMENTS (1 << 22)
+
+// Largest size exercised unless overridden with `-n`
+#define BENCH_DEFAULT_MAX 10000000
+
+
+#pragma region Inputs
+
+static inline uint64_t key_of(uint64_t elem)
+{
+    return elem >> 32;
+}
+
+static inline uint64_t index_of(uint64_t elem)
+{
+    return elem & UINT32_MAX;
+}
+
+static uint64_t rng_state;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+typedef struct distribution_t {
+    const char *name;
+    uint64_t (*key)(size_t i, size_t n);
+} distribution_t;
+
+static uint64_t key_random(size_t, size_t)
+{
+    return rng() & UINT32_MAX;
+}
+
+static uint64_t key_sorted(size_t i, size_t)
+{
+    return i;
+}
+
+static uint64_t key_reversed(size_t i, size_t n)
+{
+    return n - i;
+}
+
+static uint64_t key_sawtooth(size_t i, size_t n)
+{
+    size_t teeth = n < 16 ? 1 : 16;
+    return i % (n / teeth);
+}
+
+static uint64_t key_few_unique(size_t, size_t)
+{
+    return rng() % 16;
+}
+
+static uint64_t key_organ_pipe(size_t i, size_t n)
+{
+    return i < n / 2 ? i : n - i;
+}
+
+// Sorted, followed by a random tail of one percent
+static uint64_t key_appended(size_t i, size_t n)
+{
+    return i < n - n / 100 ? i : rng() % n;
+}
+
+static const distribution_t distributions[] = {
+    { "random", key_random },
+    { "sorted", key_sorted },
+    { "reversed", key_reversed },
+    { "sawtooth", key_sawtooth },
+    { "few-unique", key_few_unique },
+    { "organ-pipe", key_organ_pipe },
+    { "appended", key_appended },
+};
+
+static void generate(uint64_t *data, size_t n, const distribution_t *dist)
+{
+    for (size_t i = 0; i < n; i++) {
+        data[i] = (dist->key(i, n) & UINT32_MAX) << 32 | (i & UINT32_MAX);
+    }
+}
+
+#pragma endregion
+
+
+#pragma region Algorithms
+
+static size_t compares;
+
+static ptrdiff_t cmp_xsort(const void *a, const void *b, void *)
+{
+    compares++;
+    uint64_t x = key_of(*(const uint64_t *)a);
+    uint64_t y = key_of(*(const uint64_t *)b);
+    return (x > y) - (x < y);
+}
+
+static int cmp_qsort_r(const void *a, const void *b, void *)
+{
+    compares++;
+    uint64_t x = key_of(*(const uint64_t *)a);
+    uint64_t y = key_of(*(const uint64_t *)b);
+    return (x > y) - (x < y);
+}
+
+static inline bool less(uint64_t a, uint64_t b)
+{
+    compares++;
+    return key_of(a) < key_of(b);
+}
+
+static void run_xsort(uint64_t *data, size_t n)
+{
+    xsort(data, n, cmp_xsort, NULL);
+}
+
+static void run_qsort_r(uint64_t *data, size_t n)
+{
+    qsort_r(data, n, sizeof(uint64_t), cmp_qsort_r, NULL);
+}
+
+static void run_std_sort(uint64_t *data, size_t n)
+{
+    std::sort(data, data + n, less);
+}
+
+static void run_std_stable_sort(uint64_t *data, size_t n)
+{
+    std::stable_sort(data, data + n, less);
+}
+
+#ifdef BENCH_PDQSORT
+static void run_pdqsort(uint64_t *data, size_t n)
+{
+    pdqsort(data, data + n, less);
+}
+#endif
+
+typedef struct algorithm_t {
+    const char *name;
+    void (*run)(uint64_t *data, size_t n);
+    bool stable;
+} algorithm_t;
+
+static const algorithm_t algorithms[] = {
+    { "xsort", run_xsort, true },
+    { "qsort_r", run_qsort_r, false },
+    { "std::sort", run_std_sort, false },
+    { "std::stable_sort", run_std_stable_sort, true },
+#ifdef BENCH_PDQSORT
+    { "pdqsort", run_pdqsort, false },
+#endif
+};
+
+#pragma endregion
+
+
+#pragma region Measurement
+
+typedef struct result_t {
+    double ns_per_elem;
+    double cmp_per_elem;
+    long peak_kib;
+    bool sorted;
+    bool stable;
+} result_t;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static long max_rss_kib(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void verify(const uint64_t *data, size_t n, result_t *res)
+{
+    res->sorted = true;
+    res->stable = true;
+    for (size_t i = 1; i < n; i++) {
+        if (key_of(data[i]) < key_of(data[i - 1])) {
+            res->sorted = false;
+        }
+        else if (key_of(data[i]) == key_of(data[i - 1]) && index_of(data[i]) < index_of(data[i - 1])) {
+            res->stable = false;
+        }
+    }
+}
+
+// Sort `reps` copies of `input` back to back. All memory the batch needs
+// is touched before the baseline RSS is sampled, so the reported peak is
+// whatever the sort itself allocated
+static result_t measure(const algorithm_t *algo, const uint64_t *input, size_t n)
+{
+    size_t reps = n < BENCH_BATCH_ELEMENTS ? BENCH_BATCH_ELEMENTS / n : 1;
+    std::vector<uint64_t> batch(reps * n);
+    for (size_t r = 0; r < reps; r++) {
+        memcpy(&batch[r * n], input, n * sizeof(uint64_t));
+    }
+
+    long baseline = max_rss_kib();
+    compares = 0;
+    double start = now_ns();
+    for (size_t r = 0; r < reps; r++) {
+        algo->run(&batch[r * n], n);
+    }
+    double elapsed = now_ns() - start;
+
+    result_t res = { 0 };
+    res.ns_per_elem = elapsed / (double)(reps * n);
+    res.cmp_per_elem = (double)compares / (double)(reps * n);
+    res.peak_kib = max_rss_kib() - baseline;
+    verify(&batch[0], n, &res);
+    return res;
+}
+
+// Run `measure()` in a child process and collect its result over a pipe
+static bool measure_isolated(const algorithm_t *algo, const uint64_t *input, size_t n, result_t *res)
+{
+    int fds[2];
+    if (pipe(fds)) {
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (!pid) {
+        close(fds[0]);
+        result_t child = measure(algo, input, n);
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == (ssize_t)sizeof(child) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return got == (ssize_t)sizeof(*res) && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+#pragma endregion
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n max_elements] [-d distribution] [-a algorithm] [-s seed]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_elements = BENCH_DEFAULT_MAX;
+    const char *only_dist = NULL;
+    const char *only_algo = NULL;
+    uint64_t seed = UINT64_C(88172645463325252);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:a:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                max_elements = (size_t)strtod(optarg, NULL);
+                break;
+            case 'd':
+                only_dist = optarg;
+                break;
+            case 'a':
+                only_algo = optarg;
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0) | 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    // Indices are packed into 32 bits, so larger inputs cannot be checked
+    if (max_elements > UINT32_MAX) {
+        max_elements = UINT32_MAX;
+    }
+
+    printf("%-12s %-11s %-17s %10s %10s %10s %7s %7s\n", "elements", "input", "algorithm", "ns/elem", "cmp/elem", "peak KiB", "sorted", "stable");
+
+    bool failed = false;
+    for (const distribution_t &dist : distributions) {
+        if (only_dist && strcmp(only_dist, dist.name)) {
+            continue;
+        }
+        for (size_t n = 8; n <= max_elements; n = n < max_elements && n * 8 > max_elements ? max_elements : n * 8) {
+            std::vector<uint64_t> input(n);
+            rng_state = seed;
+            generate(&input[0], n, &dist);
+
+            for (const algorithm_t &algo : algorithms) {
+                if (only_algo && strcmp(only_algo, algo.name)) {
+                    continue;
+                }
+
+                result_t res;
+                if (!measure_isolated(&algo, &input[0], n, &res)) {
+                    printf("%-12zu %-11s %-17s %10s\n", n, dist.name, algo.name, "failed");
+                    failed = true;
+                    continue;
+                }
+
+                // Stability is only a failure for sorts that promise it
+                const char *stable = res.stable ? "yes" : algo.stable ? "BROKEN" : "no";
+                printf("%-12zu %-11s %-17s %10.2f %10.2f %10ld %7s %7s\n", n, dist.name, algo.name, res.ns_per_elem, res.cmp_per_elem, res.peak_kib, res.sorted ? "yes" : "BROKEN", stable);
+                failed |= !res.sorted || (algo.stable && !res.stable);
+            }
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,261 @@
+/**
+ * @file allocator.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort` with an allocator that always fails
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * With no memory to be had, the sorts fall back to the in-place merges of
+ * `XSORT_FLAG_LOWMEM` over their on-stack buffer, and must stay stable
+ * under every combination of flags. Only the sorts documented to need
+ * memory may fail, and then with `ENOMEM` and the array untouched.
+ *
+ * Usage: allocator [seed]
+ *
+ */
+
+#include "test.h"
+
+typedef struct refusals_t {
+    size_t allocs;
+    size_t releases;
+} refusals_t;
+
+static void *refuse_alloc(size_t size, void *ctx)
+{
+    (void)size;
+    ((refusals_t *)ctx)->allocs++;
+    return NULL;
+}
+
+static void refuse_release(void *ptr, void *ctx)
+{
+    (void)ptr;
+    ((refusals_t *)ctx)->releases++;
+}
+
+static refusals_t refusals;
+static const xsort_allocator_t refuse = { .alloc = refuse_alloc, .release = refuse_release, .ctx = &refusals };
+
+// A workspace whose every allocation fails
+static void workspace_init(xsort_workspace_t *ws, unsigned flags)
+{
+    xsort_workspace_init(ws);
+    ws->allocator = &refuse;
+    ws->flags = flags;
+}
+
+static uint64_t key_packed(const void *elem, void *arg)
+{
+    (void)arg;
+    return key_of(*(const uint64_t *)elem);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+#pragma region Checks
+
+// One sort under test, given input `elems` and its stable order `expected`
+typedef bool (*check_fn_t)(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws);
+
+// Run `check` over every size, pattern and range
+static void check_all(const char *what, unsigned flags, check_fn_t check)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!elems || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    xsort_workspace_t ws;
+    workspace_init(&ws, flags);
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                fill(elems, n, &patterns[p], ranges[r]);
+                memcpy(expected, elems, n * sizeof(uint64_t));
+                reference(expected, n);
+                expect(check(elems, expected, n, &ws), "%s flags %#x: %s keys, range %" PRIu32 ", %zu elements", what, flags,
+                    patterns[p].name, ranges[r], n);
+            }
+        }
+    }
+    xsort_workspace_destroy(&ws);
+
+    free(expected);
+    free(elems);
+}
+
+static bool check_ws(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    xsort_ws(elems, n, cmp_key, NULL, ws);
+    return sorted_stably(elems, expected, n);
+}
+
+static bool check_sized(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    return !xsort_sized_ws(elems, n, sizeof(uint64_t), cmp_key, NULL, ws) && sorted_stably(elems, expected, n);
+}
+
+// Packed values double as plain integers, distinct and in the stable order
+static bool check_u64(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    xsort_u64_ws(elems, n, ws);
+    return sorted_stably(elems, expected, n);
+}
+
+static bool check_by_key(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    xsort_by_key_ws(elems, n, key_packed, NULL, NULL, ws);
+    return sorted_stably(elems, expected, n);
+}
+
+static bool check_argsort(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    uint32_t *perm = malloc(n * sizeof(uint32_t) + 1);
+    if (!perm) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    bool ok = !xargsort_ws(elems, n, perm, sizeof(uint32_t), cmp_key, NULL, ws);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = perm[i] == (uint32_t)expected[i];
+    }
+    free(perm);
+    return ok;
+}
+
+static bool check_columns(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    uint32_t *keys = malloc(n * sizeof(uint32_t) + 1);
+    uint32_t *perm = malloc(n * sizeof(uint32_t) + 1);
+    if (!keys || !perm) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = key_of(elems[i]);
+    }
+    xsort_column_t column = { .data = keys, .type = XSORT_COLUMN_U32 };
+    bool ok = !xsort_columns_ws(&column, 1, n, perm, sizeof(uint32_t), ws);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = perm[i] == (uint32_t)expected[i];
+    }
+    free(perm);
+    free(keys);
+    return ok;
+}
+
+// Without room for its copy the prefix may hold any of the elements tied
+// with the k-th, so only its keys and the whole multiset are compared
+static bool check_partial(uint64_t *elems, const uint64_t *expected, size_t n, xsort_workspace_t *ws)
+{
+    size_t k = n ? (size_t)(rng() % (n + 1)) : 0;
+    xsort_partial_ws(elems, n, k, cmp_key, NULL, ws);
+    bool ok = true;
+    for (size_t i = 0; ok && i < k; i++) {
+        ok = key_of(elems[i]) == key_of(expected[i]);
+    }
+    reference(elems, n);
+    return ok && sorted_stably(elems, expected, n);
+}
+
+// Widths sorted through references need memory for them and must fail
+// cleanly; the rest sort in place
+static void check_widths(void)
+{
+    static const size_t widths[] = { 4, 8, 12, 16, 24, 32, 40 };
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint8_t *records = malloc(most * 40);
+    uint8_t *expected = malloc(most * 40);
+    uint64_t *packed = malloc(most * sizeof(uint64_t));
+    if (!records || !expected || !packed) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned flags = 0; flags < 16; flags++) {
+        xsort_workspace_t ws;
+        workspace_init(&ws, flags);
+        for (size_t w = 0; w < COUNT(widths); w++) {
+            size_t size = widths[w];
+            for (size_t s = 0; s < COUNT(test_sizes); s++) {
+                size_t n = test_sizes[s];
+                fill(packed, n, &patterns[0], ranges[2]);
+                for (size_t i = 0; i < n; i++) {
+                    if (size == 4) {
+                        uint32_t key = key_of(packed[i]);
+                        memcpy(&records[i * size], &key, sizeof(key));
+                    }
+                    else {
+                        record_build(&records[i * size], size, packed[i]);
+                    }
+                }
+
+                bool indirect = size != 4 && size != 8 && size != 16 && size != 32;
+                errno = 0;
+                if (indirect || size == 4) {
+                    // Four-byte records carry no index, so their order is
+                    // checked by key alone
+                    memcpy(expected, records, n * size);
+                }
+                if (size == 4) {
+                    qsort(expected, n, size, cmp_u32);
+                }
+                else if (!indirect) {
+                    reference(packed, n);
+                    for (size_t i = 0; i < n; i++) {
+                        record_build(&expected[i * size], size, packed[i]);
+                    }
+                }
+
+                int status = xsort_sized_ws(records, n, size, cmp_record, NULL, &ws);
+                bool ok = indirect && n > 1 ? status == -1 && errno == ENOMEM : !status;
+                expect(ok && (!n || !memcmp(records, expected, n * size)), "xsort_sized_ws flags %#x: %zu-byte records, %zu elements", flags,
+                    size, n);
+            }
+        }
+        xsort_workspace_destroy(&ws);
+    }
+
+    free(packed);
+    free(expected);
+    free(records);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+
+    for (unsigned flags = 0; flags < 16; flags++) {
+        check_all("xsort_ws", flags, check_ws);
+    }
+    unsigned lowmem[] = { 0, XSORT_FLAG_LOWMEM };
+    for (size_t f = 0; f < COUNT(lowmem); f++) {
+        check_all("xsort_sized_ws", lowmem[f], check_sized);
+        check_all("xsort_u64_ws", lowmem[f], check_u64);
+        check_all("xsort_by_key_ws", lowmem[f], check_by_key);
+        check_all("xargsort_ws", lowmem[f], check_argsort);
+        check_all("xsort_columns_ws", lowmem[f], check_columns);
+        check_all("xsort_partial_ws", lowmem[f], check_partial);
+    }
+    check_widths();
+
+    expect(refusals.allocs, "the allocator was never asked for memory");
+    expect(!refusals.releases, "%zu releases without an allocation", refusals.releases);
+    return test_finish();
+}
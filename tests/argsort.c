@@ -0,0 +1,149 @@
+/**
+ * @file argsort.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xargsort()` and `xargsort_by_key()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * The packed reference carries each element's original index, so the
+ * permutation must list exactly those indices in order, whichever index
+ * width and path produce it, and the keys must be left as they were.
+ *
+ * Usage: argsort [seed]
+ *
+ */
+
+#include "test.h"
+
+static uint64_t key_low(const void *elem, void *arg)
+{
+    (void)arg;
+    return key_of(*(const uint64_t *)elem);
+}
+
+// Lands in the half of the key packed beside a 32-bit index
+static uint64_t key_high(const void *elem, void *arg)
+{
+    (void)arg;
+    return (uint64_t)key_of(*(const uint64_t *)elem) << 40;
+}
+
+// Straddles both halves, so ties on the packed half need the full key
+static uint64_t key_split(const void *elem, void *arg)
+{
+    (void)arg;
+    uint64_t key = key_of(*(const uint64_t *)elem);
+    return (key / 4) << 32 | (key % 4) << 30;
+}
+
+static uint64_t key_coarse(const void *elem, void *arg)
+{
+    (void)arg;
+    return (uint64_t)(key_of(*(const uint64_t *)elem) / 3) << 32;
+}
+
+typedef struct variant_t {
+    const char *name;
+    // NULL to go through `xargsort()` with `cmp`
+    xsort_key_fn_t key;
+    cmp_ctx_fn_t cmp;
+} variant_t;
+
+static const variant_t variants[] = {
+    { "xargsort", NULL, cmp_key },
+    { "xargsort_by_key low", key_low, NULL },
+    { "xargsort_by_key high", key_high, NULL },
+    { "xargsort_by_key split", key_split, NULL },
+    { "xargsort_by_key coarse, refined", key_coarse, cmp_key },
+};
+
+static uint64_t perm_at(const void *perm, size_t i, size_t index_size)
+{
+    return index_size == sizeof(uint32_t) ? ((const uint32_t *)perm)[i] : ((const uint64_t *)perm)[i];
+}
+
+
+#pragma region Checks
+
+static void check_argsort(unsigned flags, size_t index_size)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint64_t *keys = malloc(most * sizeof(uint64_t));
+    uint64_t *input = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    uint64_t *perm = malloc(most * sizeof(uint64_t));
+    if (!keys || !input || !expected || !perm) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t v = 0; v < COUNT(variants); v++) {
+        const variant_t *variant = &variants[v];
+        for (size_t s = 0; s < COUNT(test_sizes); s++) {
+            size_t n = test_sizes[s];
+            for (size_t p = 0; p < COUNT(patterns); p++) {
+                for (size_t r = 0; r < COUNT(ranges); r++) {
+                    fill(keys, n, &patterns[p], ranges[r]);
+                    memcpy(input, keys, n * sizeof(uint64_t));
+                    memcpy(expected, keys, n * sizeof(uint64_t));
+                    reference(expected, n);
+
+                    int status = variant->key ? xargsort_by_key_ws(keys, n, perm, index_size, variant->key, variant->cmp, NULL, &ws)
+                                              : xargsort_ws(keys, n, perm, index_size, variant->cmp, NULL, &ws);
+                    bool ok = !status && (!n || !memcmp(keys, input, n * sizeof(uint64_t)));
+                    for (size_t i = 0; ok && i < n; i++) {
+                        ok = perm_at(perm, i, index_size) == (uint32_t)expected[i];
+                    }
+                    expect(ok, "%s flags %#x, %zu-byte indices: %s keys, range %" PRIu32 ", %zu elements", variant->name, flags, index_size,
+                        patterns[p].name, ranges[r], n);
+                }
+            }
+        }
+    }
+    xsort_workspace_destroy(&ws);
+
+    free(perm);
+    free(expected);
+    free(input);
+    free(keys);
+}
+
+static void check_errors(void)
+{
+    static const size_t widths[] = { 0, 1, 2, 3, 5, 16 };
+    uint64_t keys[4] = { 3, 1, 2, 0 };
+    uint64_t perm[4] = { 0 };
+
+    for (size_t w = 0; w < COUNT(widths); w++) {
+        for (size_t n = 0; n <= COUNT(keys); n += COUNT(keys)) {
+            errno = 0;
+            int status = xargsort(keys, n, perm, widths[w], cmp_key, NULL);
+            expect(status == -1 && errno == EINVAL, "xargsort: %zu-byte indices for %zu elements give EINVAL, got %d, errno %d", widths[w], n,
+                status, errno);
+            errno = 0;
+            status = xargsort_by_key(keys, n, perm, widths[w], key_low, NULL, NULL);
+            expect(status == -1 && errno == EINVAL, "xargsort_by_key: %zu-byte indices for %zu elements give EINVAL, got %d, errno %d", widths[w],
+                n, status, errno);
+        }
+    }
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    static const unsigned flags[] = { 0, XSORT_FLAG_LOWMEM };
+    for (size_t f = 0; f < COUNT(flags); f++) {
+        check_argsort(flags[f], sizeof(uint32_t));
+        check_argsort(flags[f], sizeof(uint64_t));
+    }
+    check_errors();
+    return test_finish();
+}
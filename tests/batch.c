@@ -0,0 +1,301 @@
+/**
+ * @file batch.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort_batch()` and its key-only counterparts
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Batches mix arrays short enough for the interleaved networks with a few
+ * longer ones, laid out back to back with a guard element after each, so
+ * that an array sorted in the wrong lane or past its end shows up. Each
+ * array must end up as its own stable reference.
+ *
+ * Usage: batch [seed]
+ *
+ */
+
+#include <math.h>
+
+#include "test.h"
+
+static const size_t batch_counts[] = { 0, 1, 2, 7, 8, 9, 100, 1000 };
+
+#define TEST_GUARD UINT64_C(0x5a5a5a5a5a5a5a5a)
+
+// Longest array drawn
+#define TEST_LENGTH_MAX 332
+
+// Rounds of random batches per count
+#define TEST_BATCHES 32
+
+typedef struct batch_t {
+    // Arrays back to back, each followed by a guard
+    uint64_t *elems;
+    uint64_t *expected;
+    void **arrays;
+    size_t *lengths;
+    size_t count;
+    size_t total;
+} batch_t;
+
+// Mostly the lengths the networks cover, sometimes longer
+static size_t length_draw(void)
+{
+    switch (rng() % 16) {
+        case 0:
+            return 0;
+        case 1:
+            return 33 + (size_t)(rng() % (TEST_LENGTH_MAX - 32));
+        default:
+            return 1 + (size_t)(rng() % 32);
+    }
+}
+
+static void batch_init(batch_t *batch)
+{
+    size_t most = batch_counts[COUNT(batch_counts) - 1];
+    batch->elems = malloc(most * (TEST_LENGTH_MAX + 1) * sizeof(uint64_t));
+    batch->expected = malloc(most * (TEST_LENGTH_MAX + 1) * sizeof(uint64_t));
+    batch->arrays = malloc(most * sizeof(void *));
+    batch->lengths = malloc(most * sizeof(size_t));
+    if (!batch->elems || !batch->expected || !batch->arrays || !batch->lengths) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void batch_destroy(batch_t *batch)
+{
+    free(batch->lengths);
+    free(batch->arrays);
+    free(batch->expected);
+    free(batch->elems);
+}
+
+// Lay out `count` arrays, filling each with `draw(i, n)`
+static void batch_draw(batch_t *batch, size_t count, uint64_t (*draw)(size_t i, size_t n))
+{
+    size_t at = 0;
+    for (size_t a = 0; a < count; a++) {
+        size_t n = length_draw();
+        batch->arrays[a] = &batch->elems[at];
+        batch->lengths[a] = n;
+        for (size_t i = 0; i < n; i++) {
+            batch->elems[at + i] = draw(i, n);
+        }
+        batch->elems[at + n] = TEST_GUARD;
+        at += n + 1;
+    }
+    batch->count = count;
+    batch->total = at;
+    memcpy(batch->expected, batch->elems, at * sizeof(uint64_t));
+}
+
+// Sort each array of `expected` with `cmp`
+static void batch_reference(batch_t *batch, int (*cmp)(const void *, const void *), size_t size)
+{
+    for (size_t a = 0, at = 0; a < batch->count; a++) {
+        qsort(&batch->expected[at], batch->lengths[a], size, cmp);
+        at += batch->lengths[a] + 1;
+    }
+}
+
+static bool batch_matches(const batch_t *batch)
+{
+    return !batch->total || !memcmp(batch->elems, batch->expected, batch->total * sizeof(uint64_t));
+}
+
+
+#pragma region Draws
+
+static const pattern_t *draw_pattern;
+static uint32_t draw_range;
+
+static uint64_t draw_packed(size_t i, size_t n)
+{
+    return pack(draw_pattern->key(i, n, draw_range), i);
+}
+
+// Extremes and small values around zero, with repeats
+static uint64_t draw_i64(size_t i, size_t n)
+{
+    (void)i;
+    (void)n;
+    static const int64_t edges[] = { INT64_MIN, INT64_MIN + 1, -1, 0, 1, INT64_MAX - 1, INT64_MAX };
+    int64_t value = rng() % 4 ? (int64_t)(rng() % (2 * draw_range + 1)) - (int64_t)draw_range : edges[rng() % COUNT(edges)];
+    return (uint64_t)value;
+}
+
+// NaNs carry their index in the payload and zeros a random sign, so the
+// order within each group of equal values is visible
+static uint64_t draw_f64(size_t i, size_t n)
+{
+    (void)n;
+    double value;
+    uint64_t bits;
+    switch (rng() % 6) {
+        case 0:
+            value = rng() & 1 ? 0.0 : -0.0;
+            break;
+        case 1:
+            bits = UINT64_C(0x7ff8000000000000) | (rng() & 1 ? UINT64_C(1) << 63 : 0) | i;
+            memcpy(&value, &bits, sizeof(value));
+            break;
+        case 2:
+            value = rng() & 1 ? INFINITY : -INFINITY;
+            break;
+        default:
+            value = (double)(rng() % (2 * draw_range + 1)) - (double)draw_range;
+            break;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+#pragma endregion
+
+
+#pragma region Reference
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// `qsort()` is not stable, so each value is tagged with its position in
+// the array, which breaks ties between zeros and between NaNs
+typedef struct f64_ref_t {
+    double value;
+    size_t index;
+} f64_ref_t;
+
+static int cmp_f64_ref(const void *a, const void *b)
+{
+    const f64_ref_t *x = a;
+    const f64_ref_t *y = b;
+    bool x_nan = isnan(x->value);
+    bool y_nan = isnan(y->value);
+    if (x_nan != y_nan) {
+        return x_nan - y_nan;
+    }
+    if (!x_nan && x->value != y->value) {
+        return x->value < y->value ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static void batch_reference_f64(batch_t *batch)
+{
+    f64_ref_t refs[TEST_LENGTH_MAX];
+    for (size_t a = 0, at = 0; a < batch->count; a++) {
+        double *values = (double *)&batch->expected[at];
+        size_t n = batch->lengths[a];
+        for (size_t i = 0; i < n; i++) {
+            refs[i] = (f64_ref_t) { .value = values[i], .index = i };
+        }
+        qsort(refs, n, sizeof(f64_ref_t), cmp_f64_ref);
+        for (size_t i = 0; i < n; i++) {
+            values[i] = refs[i].value;
+        }
+        at += n + 1;
+    }
+}
+
+#pragma endregion
+
+
+#pragma region Checks
+
+static void check_batch(batch_t *batch, unsigned flags)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t c = 0; c < COUNT(batch_counts); c++) {
+        size_t count = batch_counts[c];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                draw_pattern = &patterns[p];
+                draw_range = ranges[r];
+                batch_draw(batch, count, draw_packed);
+                batch_reference(batch, cmp_packed, sizeof(uint64_t));
+
+                if (flags) {
+                    xsort_batch_ws(batch->arrays, batch->lengths, count, cmp_key, NULL, &ws);
+                }
+                else {
+                    xsort_batch(batch->arrays, batch->lengths, count, cmp_key, NULL);
+                }
+                expect(batch_matches(batch), "xsort_batch flags %#x: %zu arrays of %s keys, range %" PRIu32, flags, count, patterns[p].name, ranges[r]);
+            }
+        }
+    }
+    xsort_workspace_destroy(&ws);
+}
+
+static void check_keys(batch_t *batch, unsigned flags)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t c = 0; c < COUNT(batch_counts); c++) {
+        size_t count = batch_counts[c];
+        for (size_t round = 0; round < TEST_BATCHES; round++) {
+            draw_pattern = &patterns[round % COUNT(patterns)];
+            draw_range = ranges[round % COUNT(ranges)];
+
+            batch_draw(batch, count, draw_packed);
+            batch_reference(batch, cmp_u64, sizeof(uint64_t));
+            xsort_u64_batch_ws((uint64_t *const *)batch->arrays, batch->lengths, count, &ws);
+            expect(batch_matches(batch), "xsort_u64_batch flags %#x: %zu arrays, round %zu", flags, count, round);
+
+            batch_draw(batch, count, draw_i64);
+            batch_reference(batch, cmp_i64, sizeof(int64_t));
+            if (flags) {
+                xsort_i64_batch_ws((int64_t *const *)batch->arrays, batch->lengths, count, &ws);
+            }
+            else {
+                xsort_i64_batch((int64_t *const *)batch->arrays, batch->lengths, count);
+            }
+            expect(batch_matches(batch), "xsort_i64_batch flags %#x: %zu arrays, round %zu", flags, count, round);
+
+            batch_draw(batch, count, draw_f64);
+            batch_reference_f64(batch);
+            if (flags) {
+                xsort_f64_batch_ws((double *const *)batch->arrays, batch->lengths, count, &ws);
+            }
+            else {
+                xsort_f64_batch((double *const *)batch->arrays, batch->lengths, count);
+            }
+            expect(batch_matches(batch), "xsort_f64_batch flags %#x: %zu arrays, round %zu", flags, count, round);
+        }
+    }
+    xsort_workspace_destroy(&ws);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    batch_t batch;
+    batch_init(&batch);
+    check_batch(&batch, 0);
+    check_batch(&batch, XSORT_FLAG_LOWMEM);
+    check_keys(&batch, 0);
+    check_keys(&batch, XSORT_FLAG_LOWMEM);
+    batch_destroy(&batch);
+    return test_finish();
+}
@@ -0,0 +1,118 @@
+/**
+ * @file by_key.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort_by_key()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Extracted keys spread the packed key over the low, middle or high bits,
+ * or keep only a coarse prefix of it that the comparator then refines.
+ * Either way the result must be the stable order of the full key.
+ *
+ * Usage: by_key [seed]
+ *
+ */
+
+#include "test.h"
+
+typedef struct extract_t {
+    const char *name;
+    xsort_key_fn_t key;
+    // Orders elements with equal extracted keys, or NULL to keep them in
+    // original order
+    cmp_ctx_fn_t cmp;
+} extract_t;
+
+// Set whenever the comparator sees two elements whose keys differ
+static bool misused;
+
+static uint64_t key_low(const void *elem, void *arg)
+{
+    (void)arg;
+    return key_of(*(const uint64_t *)elem);
+}
+
+// Reaches the top bit for the widest range
+static uint64_t key_high(const void *elem, void *arg)
+{
+    (void)arg;
+    return key_of(*(const uint64_t *)elem) * (UINT64_MAX / 100);
+}
+
+static uint64_t key_middle(const void *elem, void *arg)
+{
+    (void)arg;
+    return (uint64_t)key_of(*(const uint64_t *)elem) << 24 | 0xffffff;
+}
+
+static uint64_t key_coarse(const void *elem, void *arg)
+{
+    (void)arg;
+    return key_of(*(const uint64_t *)elem) / 3;
+}
+
+static ptrdiff_t cmp_refine(const void *a, const void *b, void *arg)
+{
+    misused |= key_coarse(a, arg) != key_coarse(b, arg);
+    return cmp_key(a, b, arg);
+}
+
+static const extract_t extracts[] = {
+    { "low", key_low, NULL },
+    { "high", key_high, NULL },
+    { "middle", key_middle, NULL },
+    { "low, refined", key_low, cmp_key },
+    { "coarse, refined", key_coarse, cmp_refine },
+};
+
+
+static void check_by_key(unsigned flags)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!elems || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t e = 0; e < COUNT(extracts); e++) {
+        for (size_t s = 0; s < COUNT(test_sizes); s++) {
+            size_t n = test_sizes[s];
+            for (size_t p = 0; p < COUNT(patterns); p++) {
+                for (size_t r = 0; r < COUNT(ranges); r++) {
+                    fill(elems, n, &patterns[p], ranges[r]);
+                    memcpy(expected, elems, n * sizeof(uint64_t));
+                    reference(expected, n);
+
+                    misused = false;
+                    if (flags) {
+                        xsort_by_key_ws(elems, n, extracts[e].key, extracts[e].cmp, NULL, &ws);
+                    }
+                    else {
+                        xsort_by_key(elems, n, extracts[e].key, extracts[e].cmp, NULL);
+                    }
+                    expect(sorted_stably(elems, expected, n) && !misused, "xsort_by_key flags %#x, %s key: %s keys, range %" PRIu32 ", %zu elements",
+                        flags, extracts[e].name, patterns[p].name, ranges[r], n);
+                }
+            }
+        }
+    }
+    xsort_workspace_destroy(&ws);
+
+    free(expected);
+    free(elems);
+}
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_by_key(0);
+    check_by_key(XSORT_FLAG_LOWMEM);
+    return test_finish();
+}
@@ -0,0 +1,300 @@
+/**
+ * @file columns.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort_columns()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Tables of up to four columns draw each column's type, direction and
+ * nulls at random, with values from a small range so that many rows tie
+ * on the leading columns. The reference sorts row indices with a
+ * comparator that walks the columns as documented, then breaks ties on
+ * the index.
+ *
+ * Usage: columns [seed]
+ *
+ */
+
+#include <math.h>
+
+#include "test.h"
+
+#define TEST_COLUMNS_MAX 4
+
+// Rounds of random tables per size
+#define TEST_TABLES 40
+
+typedef struct table_t {
+    xsort_column_t columns[TEST_COLUMNS_MAX];
+    size_t count;
+    // Backing storage, wide enough for any column type
+    uint64_t *data[TEST_COLUMNS_MAX];
+    uint8_t *nulls[TEST_COLUMNS_MAX];
+} table_t;
+
+// A float or double drawn from zeros of both signs, NaNs of both signs,
+// infinities, small integers and a few scaled values
+static double float_draw(uint32_t range)
+{
+    switch (rng() % 8) {
+        case 0:
+            return 0.0;
+        case 1:
+            return -0.0;
+        case 2:
+            return rng() & 1 ? NAN : -NAN;
+        case 3:
+            return rng() & 1 ? INFINITY : -INFINITY;
+        case 4:
+            return ldexp((double)(rng() % 64) - 32, (int)(rng() % 8) - 4);
+        default:
+            return (double)(rng() % range) - (double)(range / 2);
+    }
+}
+
+static void value_draw(uint64_t *data, size_t row, xsort_column_type_t type, uint32_t range)
+{
+    uint64_t draw = rng() % range;
+    switch (type) {
+        case XSORT_COLUMN_U32:
+            // Reach the top bit too
+            ((uint32_t *)data)[row] = (uint32_t)(draw * (UINT32_MAX / range));
+            break;
+        case XSORT_COLUMN_I32:
+            ((int32_t *)data)[row] = (int32_t)draw - (int32_t)(range / 2);
+            break;
+        case XSORT_COLUMN_F32:
+            ((float *)data)[row] = (float)float_draw(range);
+            break;
+        case XSORT_COLUMN_U64:
+            data[row] = draw * (UINT64_MAX / range);
+            break;
+        case XSORT_COLUMN_I64:
+            ((int64_t *)data)[row] = ((int64_t)draw - (int64_t)(range / 2)) * (INT64_MAX / range);
+            break;
+        case XSORT_COLUMN_F64:
+            ((double *)data)[row] = float_draw(range);
+            break;
+    }
+}
+
+static void table_init(table_t *table, size_t rows)
+{
+    for (size_t c = 0; c < TEST_COLUMNS_MAX; c++) {
+        table->data[c] = malloc(rows * sizeof(uint64_t) + 1);
+        table->nulls[c] = malloc(rows + 1);
+        if (!table->data[c] || !table->nulls[c]) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void table_destroy(table_t *table)
+{
+    for (size_t c = 0; c < TEST_COLUMNS_MAX; c++) {
+        free(table->data[c]);
+        free(table->nulls[c]);
+    }
+}
+
+static void table_draw(table_t *table, size_t rows)
+{
+    table->count = (size_t)(rng() % (TEST_COLUMNS_MAX + 1));
+    for (size_t c = 0; c < table->count; c++) {
+        xsort_column_type_t type = (xsort_column_type_t)(rng() % 6);
+        // Later columns get wider ranges, as the rows they see are fewer
+        uint32_t range = ranges[rng() % COUNT(ranges)] + (uint32_t)c * 50;
+
+        for (size_t i = 0; i < rows; i++) {
+            value_draw(table->data[c], i, type, range);
+        }
+
+        // No nulls, some, or every row null
+        const uint8_t *nulls = NULL;
+        switch (rng() % 4) {
+            case 0:
+            case 1:
+                break;
+            case 2:
+                for (size_t i = 0; i < rows; i++) {
+                    table->nulls[c][i] = rng() % 4 == 0 ? (uint8_t)(1 + rng() % 255) : 0;
+                }
+                nulls = table->nulls[c];
+                break;
+            default:
+                memset(table->nulls[c], 1, rows);
+                nulls = table->nulls[c];
+                break;
+        }
+
+        table->columns[c] = (xsort_column_t) {
+            .data = table->data[c],
+            .type = type,
+            .descending = rng() & 1,
+            .nulls = nulls,
+            .nulls_first = rng() & 1,
+        };
+    }
+}
+
+
+#pragma region Reference
+
+// NaNs after everything else and equal to one another, -0.0 equal to +0.0
+static int cmp_float(double x, double y)
+{
+    if (isnan(x) || isnan(y)) {
+        return isnan(x) - isnan(y);
+    }
+    return (x > y) - (x < y);
+}
+
+static int cmp_value(const xsort_column_t *column, size_t a, size_t b)
+{
+    switch (column->type) {
+        case XSORT_COLUMN_U32: {
+            uint32_t x = ((const uint32_t *)column->data)[a];
+            uint32_t y = ((const uint32_t *)column->data)[b];
+            return (x > y) - (x < y);
+        }
+        case XSORT_COLUMN_I32: {
+            int32_t x = ((const int32_t *)column->data)[a];
+            int32_t y = ((const int32_t *)column->data)[b];
+            return (x > y) - (x < y);
+        }
+        case XSORT_COLUMN_F32:
+            return cmp_float(((const float *)column->data)[a], ((const float *)column->data)[b]);
+        case XSORT_COLUMN_U64: {
+            uint64_t x = ((const uint64_t *)column->data)[a];
+            uint64_t y = ((const uint64_t *)column->data)[b];
+            return (x > y) - (x < y);
+        }
+        case XSORT_COLUMN_I64: {
+            int64_t x = ((const int64_t *)column->data)[a];
+            int64_t y = ((const int64_t *)column->data)[b];
+            return (x > y) - (x < y);
+        }
+        case XSORT_COLUMN_F64:
+            return cmp_float(((const double *)column->data)[a], ((const double *)column->data)[b]);
+    }
+    return 0;
+}
+
+// `qsort()` has no context argument
+static const table_t *reference_table;
+
+static int cmp_rows(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    for (size_t c = 0; c < reference_table->count; c++) {
+        const xsort_column_t *column = &reference_table->columns[c];
+        bool x_null = column->nulls && column->nulls[x];
+        bool y_null = column->nulls && column->nulls[y];
+        if (x_null || y_null) {
+            if (x_null != y_null) {
+                return x_null == column->nulls_first ? -1 : 1;
+            }
+            continue;
+        }
+        int order = cmp_value(column, x, y);
+        if (order) {
+            return column->descending ? -order : order;
+        }
+    }
+    return (x > y) - (x < y);
+}
+
+static void reference_rows(const table_t *table, uint64_t *expected, size_t rows)
+{
+    for (size_t i = 0; i < rows; i++) {
+        expected[i] = i;
+    }
+    reference_table = table;
+    qsort(expected, rows, sizeof(uint64_t), cmp_rows);
+}
+
+#pragma endregion
+
+
+#pragma region Checks
+
+static void check_columns(unsigned flags)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    table_t table;
+    table_init(&table, most);
+    uint64_t *expected = malloc(most * sizeof(uint64_t) + 1);
+    uint64_t *perm = malloc(most * sizeof(uint64_t) + 1);
+    if (!expected || !perm) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t rows = test_sizes[s];
+        for (size_t round = 0; round < TEST_TABLES; round++) {
+            table_draw(&table, rows);
+            reference_rows(&table, expected, rows);
+
+            size_t index_size = round & 1 ? sizeof(uint64_t) : sizeof(uint32_t);
+            bool ok = !xsort_columns_ws(table.columns, table.count, rows, perm, index_size, &ws);
+            for (size_t i = 0; ok && i < rows; i++) {
+                ok = (index_size == sizeof(uint32_t) ? ((const uint32_t *)perm)[i] : perm[i]) == expected[i];
+            }
+            expect(ok, "xsort_columns flags %#x, %zu-byte indices: %zu columns, %zu rows", flags, index_size, table.count, rows);
+        }
+    }
+    xsort_workspace_destroy(&ws);
+
+    free(perm);
+    free(expected);
+    table_destroy(&table);
+}
+
+// Tables too small to need their data, and index widths that cannot work
+static void check_edges(void)
+{
+    xsort_column_t column = { .data = NULL, .type = XSORT_COLUMN_U64 };
+    uint32_t perm[2] = { 7, 7 };
+
+    int status = xsort_columns(&column, 1, 0, NULL, sizeof(uint32_t));
+    expect(!status, "xsort_columns: no rows, got %d", status);
+
+    uint64_t one = 42;
+    column.data = &one;
+    status = xsort_columns(&column, 1, 1, perm, sizeof(uint32_t));
+    expect(!status && perm[0] == 0 && perm[1] == 7, "xsort_columns: one row, got %d, index %" PRIu32, status, perm[0]);
+
+    static const size_t widths[] = { 0, 1, 2, 3, 5, 16 };
+    for (size_t w = 0; w < COUNT(widths); w++) {
+        errno = 0;
+        status = xsort_columns(&column, 1, 1, perm, widths[w]);
+        expect(status == -1 && errno == EINVAL, "xsort_columns: %zu-byte indices give EINVAL, got %d, errno %d", widths[w], status, errno);
+    }
+
+    // Rejected before any row is read
+    if (SIZE_MAX > UINT32_MAX) {
+        errno = 0;
+        status = xsort_columns(&column, 1, (size_t)UINT32_MAX + 2, perm, sizeof(uint32_t));
+        expect(status == -1 && errno == EINVAL, "xsort_columns: 4-byte indices for 2^32 + 1 rows give EINVAL, got %d, errno %d", status, errno);
+    }
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_columns(0);
+    check_columns(XSORT_FLAG_LOWMEM);
+    check_edges();
+    return test_finish();
+}
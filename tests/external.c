@@ -0,0 +1,146 @@
+/**
+ * @file external.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort_external()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Streams go through temporary files. At the smallest budget the library
+ * accepts, 4 MiB, a chunk holds 256Ki elements and at most three runs are
+ * merged at once, so the longer inputs spill several runs and take more
+ * than one merge pass.
+ *
+ * Usage: external [seed]
+ *
+ */
+
+#include <unistd.h>
+
+#include "test.h"
+
+// Elements in one chunk at the smallest budget
+#define TEST_CHUNK ((size_t)(4 << 20) / (2 * sizeof(uint64_t)))
+
+static const size_t external_sizes[] = { 0, 1, 1000, TEST_CHUNK - 1, TEST_CHUNK, TEST_CHUNK + 1, 4 * TEST_CHUNK + 7, 10 * TEST_CHUNK + 3 };
+
+// Budgets of zero and below the minimum are raised to it
+static const size_t budgets[] = { 0, 4 << 20, 64 << 20 };
+
+
+// Write `bytes` of `data` to a new temporary file, left at its start
+static FILE *stream_of(const void *data, size_t bytes)
+{
+    FILE *stream = tmpfile();
+    if (!stream) {
+        perror("tmpfile");
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(data, 1, bytes, stream) != bytes || fflush(stream) || lseek(fileno(stream), 0, SEEK_SET)) {
+        perror("fwrite");
+        exit(EXIT_FAILURE);
+    }
+    return stream;
+}
+
+// Whether `stream` holds exactly the `n` elements of `expected`
+static bool holds(FILE *stream, const uint64_t *expected, uint64_t *buffer, size_t n)
+{
+    off_t length = lseek(fileno(stream), 0, SEEK_END);
+    if (length < 0 || (size_t)length != n * sizeof(uint64_t) || lseek(fileno(stream), 0, SEEK_SET)) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < n * sizeof(uint64_t)) {
+        ssize_t got = read(fileno(stream), (uint8_t *)buffer + done, n * sizeof(uint64_t) - done);
+        if (got <= 0) {
+            return false;
+        }
+        done += (size_t)got;
+    }
+    return sorted_stably(buffer, expected, n);
+}
+
+static void check_sorts(void)
+{
+    size_t most = external_sizes[COUNT(external_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    uint64_t *output = malloc(most * sizeof(uint64_t));
+    if (!elems || !expected || !output) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t s = 0; s < COUNT(external_sizes); s++) {
+        size_t n = external_sizes[s];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                // The largest inputs only take random keys, to keep the run short
+                if (n > 4 * TEST_CHUNK && (p != 0 || r == 0)) {
+                    continue;
+                }
+                fill(elems, n, &patterns[p], ranges[r]);
+                memcpy(expected, elems, n * sizeof(uint64_t));
+                reference(expected, n);
+
+                for (size_t b = 0; b < COUNT(budgets); b++) {
+                    FILE *in = stream_of(elems, n * sizeof(uint64_t));
+                    FILE *out = tmpfile();
+                    if (!out) {
+                        perror("tmpfile");
+                        exit(EXIT_FAILURE);
+                    }
+                    int status = xsort_external(fileno(in), fileno(out), budgets[b], cmp_key, NULL);
+                    expect(!status && holds(out, expected, output, n), "xsort_external budget %zu: %s keys, range %" PRIu32 ", %zu elements",
+                        budgets[b], patterns[p].name, ranges[r], n);
+                    fclose(out);
+                    fclose(in);
+                }
+            }
+        }
+    }
+
+    free(output);
+    free(expected);
+    free(elems);
+}
+
+static void check_errors(void)
+{
+    FILE *out = tmpfile();
+    if (!out) {
+        perror("tmpfile");
+        exit(EXIT_FAILURE);
+    }
+
+    errno = 0;
+    int status = xsort_external(-1, fileno(out), 0, cmp_key, NULL);
+    expect(status == -1 && errno == EBADF, "xsort_external: unreadable input gives EBADF, got %d, errno %d", status, errno);
+
+    // A trailing partial element is not a stream of 64-bit elements
+    uint8_t partial[3 * sizeof(uint64_t) + 5] = { 0 };
+    FILE *in = stream_of(partial, sizeof(partial));
+    errno = 0;
+    status = xsort_external(fileno(in), fileno(out), 0, cmp_key, NULL);
+    expect(status == -1 && errno == EINVAL, "xsort_external: partial element gives EINVAL, got %d, errno %d", status, errno);
+    fclose(in);
+
+    uint64_t one = 42;
+    in = stream_of(&one, sizeof(one));
+    errno = 0;
+    status = xsort_external(fileno(in), -1, 0, cmp_key, NULL);
+    expect(status == -1 && errno == EBADF, "xsort_external: unwritable output gives EBADF, got %d, errno %d", status, errno);
+    fclose(in);
+
+    fclose(out);
+}
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_sorts();
+    check_errors();
+    return test_finish();
+}
@@ -0,0 +1,164 @@
+/**
+ * @file file.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort_file()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Files of records go under `$TMPDIR`, or `/tmp` if unset. An unlimited
+ * budget sorts them through a mapping. A budget of one byte sends them
+ * through the external pipeline, which raises the budget to its 4 MiB
+ * minimum, so the longer files spill several runs.
+ *
+ * Usage: file [seed]
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static const size_t file_widths[] = { 8, 12, 16, 24, 40 };
+static const size_t file_sizes[] = { 0, 1, 1000, 70001, 300000 };
+
+// Memory budgets, named for the path they lead to
+static const struct {
+    const char *name;
+    size_t budget;
+} budgets[] = {
+    { "mapped", 0 },
+    { "external", 1 },
+};
+
+static char path[4096];
+
+// Create the test's file with `bytes` of `data`
+static void file_write(const void *data, size_t bytes)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t done = 0; done < bytes;) {
+        ssize_t put = write(fd, (const uint8_t *)data + done, bytes - done);
+        if (put <= 0) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        done += (size_t)put;
+    }
+    close(fd);
+}
+
+// Whether the test's file holds exactly `bytes` of `expected`
+static bool file_holds(const void *expected, uint8_t *buffer, size_t bytes)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    size_t done = 0;
+    for (;;) {
+        ssize_t got = read(fd, buffer + done, bytes + 1 - done);
+        if (got <= 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    close(fd);
+    return done == bytes && (!bytes || !memcmp(buffer, expected, bytes));
+}
+
+
+#pragma region Checks
+
+static void check_sorts(void)
+{
+    size_t most = file_sizes[COUNT(file_sizes) - 1];
+    size_t widest = file_widths[COUNT(file_widths) - 1];
+    uint64_t *packed = malloc(most * sizeof(uint64_t));
+    uint8_t *records = malloc(most * widest);
+    uint8_t *expected = malloc(most * widest);
+    uint8_t *buffer = malloc(most * widest + 1);
+    if (!packed || !records || !expected || !buffer) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t w = 0; w < COUNT(file_widths); w++) {
+        size_t size = file_widths[w];
+        for (size_t s = 0; s < COUNT(file_sizes); s++) {
+            size_t n = file_sizes[s];
+            for (size_t p = 0; p < COUNT(patterns); p++) {
+                uint32_t range = ranges[(s + p) % COUNT(ranges)];
+                fill(packed, n, &patterns[p], range);
+                for (size_t i = 0; i < n; i++) {
+                    record_build(&records[i * size], size, packed[i]);
+                }
+                reference(packed, n);
+                for (size_t i = 0; i < n; i++) {
+                    record_build(&expected[i * size], size, packed[i]);
+                }
+
+                for (size_t b = 0; b < COUNT(budgets); b++) {
+                    file_write(records, n * size);
+                    int status = xsort_file(path, size, budgets[b].budget, cmp_record, NULL);
+                    expect(!status && file_holds(expected, buffer, n * size), "xsort_file %s: %zu-byte records, %s keys, range %" PRIu32 ", %zu records",
+                        budgets[b].name, size, patterns[p].name, range, n);
+                }
+            }
+        }
+    }
+
+    free(buffer);
+    free(expected);
+    free(records);
+    free(packed);
+}
+
+static void check_errors(void)
+{
+    uint8_t records[3 * 16 + 5];
+    for (size_t i = 0; i < sizeof(records); i++) {
+        records[i] = (uint8_t)(sizeof(records) - i);
+    }
+    uint8_t buffer[sizeof(records) + 1];
+
+    file_write(records, sizeof(records));
+    for (size_t b = 0; b < COUNT(budgets); b++) {
+        errno = 0;
+        int status = xsort_file(path, 0, budgets[b].budget, cmp_record, NULL);
+        expect(status == -1 && errno == EINVAL, "xsort_file %s: zero-byte records give EINVAL, got %d, errno %d", budgets[b].name, status, errno);
+
+        // A partial record at the end, which must not be touched
+        errno = 0;
+        status = xsort_file(path, 16, budgets[b].budget, cmp_record, NULL);
+        expect(status == -1 && errno == EINVAL, "xsort_file %s: partial record gives EINVAL, got %d, errno %d", budgets[b].name, status, errno);
+        expect(file_holds(records, buffer, sizeof(records)), "xsort_file %s: partial record changed the file", budgets[b].name);
+    }
+    unlink(path);
+
+    errno = 0;
+    int status = xsort_file(path, 16, 0, cmp_record, NULL);
+    expect(status == -1 && errno == ENOENT, "xsort_file: missing file gives ENOENT, got %d, errno %d", status, errno);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/xsort-test-%ld", dir && *dir ? dir : "/tmp", (long)getpid());
+
+    check_sorts();
+    check_errors();
+    unlink(path);
+    return test_finish();
+}
@@ -0,0 +1,146 @@
+/**
+ * @file incremental.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for the incremental sorts of `xsort_ctx_t`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Inputs are appended in chunks of random length, from single elements to
+ * several batches at a time, with views taken along the way. Every view
+ * must be the stable reference of everything appended so far.
+ *
+ * Usage: incremental [seed]
+ *
+ */
+
+#include "test.h"
+
+// Longest chunk appended at once, a few of the collection's batches
+#define TEST_CHUNK_MAX 3000
+
+// Allocator that can be told to refuse, backed by `malloc()` otherwise
+static bool refusing;
+
+static void *gate_alloc(size_t size, void *ctx)
+{
+    (void)ctx;
+    return refusing ? NULL : malloc(size);
+}
+
+static void gate_release(void *ptr, void *ctx)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+static const xsort_allocator_t gate = { .alloc = gate_alloc, .release = gate_release };
+
+// Whether the collection's view is the stable sort of `input[0, n)`
+static bool views(xsort_ctx_t *ctx, const uint64_t *input, uint64_t *expected, size_t n)
+{
+    memcpy(expected, input, n * sizeof(uint64_t));
+    reference(expected, n);
+    size_t elements = SIZE_MAX;
+    const uint64_t *view = xsort_ctx_view(ctx, &elements);
+    return elements == n && sorted_stably(view, expected, n);
+}
+
+
+#pragma region Checks
+
+static void check_appends(unsigned flags)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint64_t *input = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!input || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                fill(input, n, &patterns[p], ranges[r]);
+
+                xsort_ctx_t ctx;
+                xsort_ctx_init(&ctx, cmp_key, NULL);
+                ctx.ws.flags = flags;
+                bool ok = true;
+                for (size_t done = 0; ok && done < n;) {
+                    size_t chunk = 1 + (size_t)(rng() % (rng() % 2 ? 16 : TEST_CHUNK_MAX));
+                    chunk = chunk < n - done ? chunk : n - done;
+                    ok = !xsort_ctx_append(&ctx, &input[done], chunk);
+                    done += chunk;
+
+                    // Look at the collection now and then, which merges
+                    // every run before the next append
+                    if (ok && rng() % 8 == 0) {
+                        ok = views(&ctx, input, expected, done);
+                    }
+                    else if (ok && rng() % 8 == 0) {
+                        xsort_ctx_flush(&ctx);
+                    }
+                }
+                ok = ok && !xsort_ctx_append(&ctx, NULL, 0) && views(&ctx, input, expected, n);
+                xsort_ctx_destroy(&ctx);
+                expect(ok, "xsort_ctx flags %#x: %s keys, range %" PRIu32 ", %zu elements", flags, patterns[p].name, ranges[r], n);
+            }
+        }
+    }
+
+    free(expected);
+    free(input);
+}
+
+// Appends that cannot grow the collection must leave it as it was
+static void check_refusals(void)
+{
+    size_t n = 1 << 17;
+    uint64_t *input = malloc(n * sizeof(uint64_t));
+    uint64_t *expected = malloc(n * sizeof(uint64_t));
+    if (!input || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    fill(input, n, &patterns[0], ranges[2]);
+
+    xsort_ctx_t ctx;
+    xsort_ctx_init(&ctx, cmp_key, NULL);
+    ctx.ws.allocator = &gate;
+    size_t done = 0;
+    for (size_t round = 0; round < 8; round++) {
+        size_t chunk = 1 + (size_t)(rng() % TEST_CHUNK_MAX);
+        refusing = false;
+        expect(!xsort_ctx_append(&ctx, &input[done], chunk), "xsort_ctx_append: %zu elements after %zu", chunk, done);
+        done += chunk;
+
+        // Ask for more than the collection can already hold
+        refusing = true;
+        size_t over = ctx.capacity - ctx.elements + 1;
+        errno = 0;
+        int status = xsort_ctx_append(&ctx, &input[done], over);
+        expect(status == -1 && errno == ENOMEM, "xsort_ctx_append: refused growth gives ENOMEM, got %d, errno %d", status, errno);
+        expect(views(&ctx, input, expected, done), "xsort_ctx_append: refused growth changed %zu elements", done);
+    }
+    refusing = false;
+    xsort_ctx_destroy(&ctx);
+
+    free(expected);
+    free(input);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_appends(0);
+    check_appends(XSORT_FLAG_LOWMEM);
+    check_refusals();
+    return test_finish();
+}
@@ -0,0 +1,191 @@
+/**
+ * @file job.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for the resumable sorts of `xsort_job_t`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Jobs are stepped to completion under budgets from nothing to everything,
+ * over lengths either side of whole blocks and with odd and even numbers
+ * of merge passes, and must end in the stable reference. Cancelled jobs
+ * must leave the array a permutation of its input, whichever phase they
+ * were stopped in.
+ *
+ * Usage: job [seed]
+ *
+ */
+
+#include "test.h"
+
+static const size_t job_sizes[] = {
+    0,
+    1,
+    2,
+    1000,
+    XSORT_STEP_BLOCK - 1,
+    XSORT_STEP_BLOCK,
+    XSORT_STEP_BLOCK + 1,
+    2 * XSORT_STEP_BLOCK,
+    3 * XSORT_STEP_BLOCK + 5,
+    8 * XSORT_STEP_BLOCK,
+    70001,
+};
+
+static const size_t budgets[] = { 0, 1, 1000, XSORT_STEP_BLOCK, 3 * XSORT_STEP_BLOCK + 1, SIZE_MAX };
+
+// What the callbacks have seen of one job
+typedef struct observer_t {
+    size_t calls;
+    size_t done;
+    size_t total;
+    bool regressed;
+    // Polls left before `cancel()` stops the job, or SIZE_MAX for never
+    size_t polls;
+} observer_t;
+
+static void observe_progress(size_t done, size_t total, void *user)
+{
+    observer_t *observer = user;
+    observer->regressed |= done < observer->done || (observer->calls && total != observer->total) || done > total;
+    observer->calls++;
+    observer->done = done;
+    observer->total = total;
+}
+
+static bool observe_cancel(void *user)
+{
+    observer_t *observer = user;
+    if (observer->polls == SIZE_MAX) {
+        return false;
+    }
+    return !observer->polls || !--observer->polls;
+}
+
+
+#pragma region Checks
+
+static void check_steps(void)
+{
+    size_t most = job_sizes[COUNT(job_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!elems || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t s = 0; s < COUNT(job_sizes); s++) {
+        size_t n = job_sizes[s];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t b = 0; b < COUNT(budgets); b++) {
+                uint32_t range = ranges[(b + p) % COUNT(ranges)];
+                fill(elems, n, &patterns[p], range);
+                memcpy(expected, elems, n * sizeof(uint64_t));
+                reference(expected, n);
+
+                xsort_job_t job;
+                observer_t observer = { .polls = SIZE_MAX };
+                bool ok = !xsort_job_init(&job, elems, n, cmp_key, NULL);
+                job.progress = observe_progress;
+                job.cancel = observe_cancel;
+                job.user = &observer;
+
+                // Every step makes progress, so the number of them is bounded
+                size_t steps = 0;
+                int status = 1;
+                while (ok && status == 1 && steps++ <= job.total + 1) {
+                    status = xsort_step(&job, budgets[b]);
+                }
+                ok = ok && !status && xsort_step(&job, budgets[b]) == 0;
+                ok = ok && !observer.regressed && observer.done == job.total && sorted_stably(elems, expected, n);
+                xsort_job_destroy(&job);
+                expect(ok, "xsort_step budget %zu: %s keys, range %" PRIu32 ", %zu elements", budgets[b], patterns[p].name, range, n);
+            }
+        }
+    }
+
+    free(expected);
+    free(elems);
+}
+
+static void check_cancels(void)
+{
+    size_t most = job_sizes[COUNT(job_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!elems || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t s = 0; s < COUNT(job_sizes); s++) {
+        size_t n = job_sizes[s];
+        for (size_t round = 0; round < 16; round++) {
+            const pattern_t *pattern = &patterns[round % COUNT(patterns)];
+            uint32_t range = ranges[round % COUNT(ranges)];
+            fill(elems, n, pattern, range);
+            memcpy(expected, elems, n * sizeof(uint64_t));
+            reference(expected, n);
+
+            // Stop anywhere from the first unit of work to the last
+            size_t units = n / XSORT_STEP_BLOCK * 8 + 2;
+            size_t polls = (size_t)(rng() % units);
+            observer_t observer = { .polls = polls };
+            xsort_job_t job;
+            bool ok = !xsort_job_init(&job, elems, n, cmp_key, NULL);
+            job.cancel = observe_cancel;
+            job.progress = observe_progress;
+            job.user = &observer;
+
+            int status = 1;
+            while (ok && status == 1) {
+                status = xsort_step(&job, (size_t)(rng() % (2 * XSORT_STEP_BLOCK)));
+            }
+            bool cancelled = status == -1;
+            if (cancelled) {
+                ok = ok && errno == ECANCELED;
+                errno = 0;
+                ok = ok && xsort_step(&job, SIZE_MAX) == -1 && errno == ECANCELED;
+            }
+            else {
+                // Finished before the cancellation came due
+                ok = ok && !status && sorted_stably(elems, expected, n);
+            }
+            xsort_job_destroy(&job);
+
+            reference(elems, n);
+            ok = ok && !observer.regressed && sorted_stably(elems, expected, n);
+            expect(ok, "xsort_step %s after %zu polls: %s keys, range %" PRIu32 ", %zu elements", cancelled ? "cancelled" : "finished",
+                polls, pattern->name, range, n);
+        }
+    }
+
+    free(expected);
+    free(elems);
+}
+
+static void check_errors(void)
+{
+    // Too long for any workspace, and refused before the array is touched
+    uint64_t elems[2] = { 2, 1 };
+    xsort_job_t job;
+    errno = 0;
+    int status = xsort_job_init(&job, elems, SIZE_MAX / sizeof(uint64_t) + 1, cmp_key, NULL);
+    expect(status == -1 && errno == ENOMEM, "xsort_job_init: unreservable length gives ENOMEM, got %d, errno %d", status, errno);
+    expect(elems[0] == 2 && elems[1] == 1, "xsort_job_init: failure touched the array");
+    xsort_job_destroy(&job);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_steps();
+    check_cancels();
+    check_errors();
+    return test_finish();
+}
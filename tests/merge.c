@@ -0,0 +1,93 @@
+/**
+ * @file merge.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xmerge_k()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Original indices rise from one run to the next, so merging the sorted
+ * runs with equal keys kept in run order is the same as sorting all of
+ * their packed values at once.
+ *
+ * Usage: merge [seed]
+ *
+ */
+
+#include "test.h"
+
+// Run counts: none, the copy and two-way cases, and loser trees of
+// every shape from a single internal node up
+static const size_t run_counts[] = { 0, 1, 2, 3, 4, 5, 8, 13, 64, 257, 1000 };
+
+// Run lengths are drawn up to this, and one in four runs is empty
+#define TEST_RUN_MAX 300
+
+
+static void check_merges(void)
+{
+    size_t most = run_counts[COUNT(run_counts) - 1];
+    const void **runs = malloc(most * sizeof(void *));
+    size_t *lengths = malloc(most * sizeof(size_t));
+    uint64_t *elems = malloc(most * TEST_RUN_MAX * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * TEST_RUN_MAX * sizeof(uint64_t));
+    uint64_t *merged = malloc((most * TEST_RUN_MAX + 1) * sizeof(uint64_t));
+    if (!runs || !lengths || !elems || !expected || !merged) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t c = 0; c < COUNT(run_counts); c++) {
+        size_t k = run_counts[c];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                size_t n = 0;
+                for (size_t i = 0; i < k; i++) {
+                    lengths[i] = rng() % 4 ? 1 + (size_t)(rng() % TEST_RUN_MAX) : 0;
+                    runs[i] = &elems[n];
+                    for (size_t j = 0; j < lengths[i]; j++) {
+                        elems[n + j] = pack(patterns[p].key(j, lengths[i], ranges[r]), n + j);
+                    }
+                    reference(&elems[n], lengths[i]);
+                    n += lengths[i];
+                }
+                memcpy(expected, elems, n * sizeof(uint64_t));
+                reference(expected, n);
+
+                // The element past the end must survive
+                merged[n] = 0x5a5a5a5a5a5a5a5a;
+                int status = xmerge_k(runs, lengths, k, merged, cmp_key, NULL);
+                expect(!status && sorted_stably(merged, expected, n) && merged[n] == 0x5a5a5a5a5a5a5a5a,
+                    "xmerge_k %zu runs: %s keys, range %" PRIu32 ", %zu elements", k, patterns[p].name, ranges[r], n);
+            }
+        }
+    }
+
+    free(merged);
+    free(expected);
+    free(elems);
+    free(lengths);
+    free(runs);
+}
+
+static void check_errors(void)
+{
+    // Runs this many cannot be tracked, and none of them are read before
+    // the tracking fails
+    const void *runs[1] = { NULL };
+    size_t lengths[1] = { 0 };
+    uint64_t dst = 0;
+
+    errno = 0;
+    int status = xmerge_k(runs, lengths, SIZE_MAX / (2 * sizeof(void *)), &dst, cmp_key, NULL);
+    expect(status == -1 && errno == ENOMEM, "xmerge_k: too many runs gives ENOMEM, got %d, errno %d", status, errno);
+}
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_merges();
+    check_errors();
+    return test_finish();
+}
@@ -0,0 +1,174 @@
+/**
+ * @file partial.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Tests for `xsort_partial()` and `xselect_nth()`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * A partial sort must leave exactly the stable reference in its prefix,
+ * except under `XSORT_FLAG_LOWMEM`, where only the prefix's keys are
+ * specified. Selection is not stable, so it is checked by key. Either way
+ * the array must remain a permutation of its input.
+ *
+ * Usage: partial [seed]
+ *
+ */
+
+#include "test.h"
+
+// Prefix lengths to try for `n` elements, including ones past the end
+static size_t prefix_length(size_t choice, size_t n)
+{
+    switch (choice) {
+        case 0:
+            return 0;
+        case 1:
+            return 1;
+        case 2:
+            return n / 2;
+        case 3:
+            return n ? (size_t)(rng() % n) : 0;
+        case 4:
+            return n ? n - 1 : 0;
+        case 5:
+            return n;
+        default:
+            return n + 5;
+    }
+}
+
+#define TEST_PREFIX_CHOICES 7
+
+// Whether `elems` holds the same elements as `expected`, the stable sort
+// of the input. Sorts `elems`
+static bool permutation_of(uint64_t *elems, const uint64_t *expected, size_t n)
+{
+    reference(elems, n);
+    return sorted_stably(elems, expected, n);
+}
+
+// Whether nothing before `at` orders after `elems[at]`, and nothing after
+// it orders before
+static bool partitioned(const uint64_t *elems, size_t n, size_t at)
+{
+    uint32_t key = key_of(elems[at]);
+    for (size_t i = 0; i < at; i++) {
+        if (key_of(elems[i]) > key) {
+            return false;
+        }
+    }
+    for (size_t i = at + 1; i < n; i++) {
+        if (key_of(elems[i]) < key) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+#pragma region Checks
+
+static void check_partial(unsigned flags)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!elems || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                for (size_t c = 0; c < TEST_PREFIX_CHOICES; c++) {
+                    fill(elems, n, &patterns[p], ranges[r]);
+                    memcpy(expected, elems, n * sizeof(uint64_t));
+                    reference(expected, n);
+
+                    size_t k = prefix_length(c, n);
+                    size_t sorted = k < n ? k : n;
+                    xsort_partial_ws(elems, n, k, cmp_key, NULL, &ws);
+
+                    bool ok = true;
+                    if (flags & XSORT_FLAG_LOWMEM) {
+                        for (size_t i = 0; ok && i < sorted; i++) {
+                            ok = key_of(elems[i]) == key_of(expected[i]);
+                        }
+                    }
+                    else {
+                        ok = sorted_stably(elems, expected, sorted);
+                    }
+                    ok = ok && (!sorted || sorted == n || partitioned(elems, n, sorted - 1));
+                    ok = ok && permutation_of(elems, expected, n);
+                    expect(ok, "xsort_partial flags %#x, k %zu: %s keys, range %" PRIu32 ", %zu elements", flags, k, patterns[p].name, ranges[r], n);
+                }
+            }
+        }
+    }
+    xsort_workspace_destroy(&ws);
+
+    free(expected);
+    free(elems);
+}
+
+static void check_select(void)
+{
+    size_t most = test_sizes[COUNT(test_sizes) - 1];
+    uint64_t *elems = malloc(most * sizeof(uint64_t));
+    uint64_t *input = malloc(most * sizeof(uint64_t));
+    uint64_t *expected = malloc(most * sizeof(uint64_t));
+    if (!elems || !input || !expected) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                for (size_t c = 0; c < TEST_PREFIX_CHOICES; c++) {
+                    fill(input, n, &patterns[p], ranges[r]);
+                    memcpy(elems, input, n * sizeof(uint64_t));
+                    memcpy(expected, input, n * sizeof(uint64_t));
+                    reference(expected, n);
+
+                    size_t nth = prefix_length(c, n);
+                    xselect_nth(elems, n, nth, cmp_key, NULL);
+
+                    bool ok;
+                    if (nth < n) {
+                        ok = key_of(elems[nth]) == key_of(expected[nth]) && partitioned(elems, n, nth) && permutation_of(elems, expected, n);
+                    }
+                    else {
+                        // Out of range, so nothing moves
+                        ok = !n || !memcmp(elems, input, n * sizeof(uint64_t));
+                    }
+                    expect(ok, "xselect_nth %zu: %s keys, range %" PRIu32 ", %zu elements", nth, patterns[p].name, ranges[r], n);
+                }
+            }
+        }
+    }
+
+    free(expected);
+    free(input);
+    free(elems);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    check_partial(0);
+    check_partial(XSORT_FLAG_LOWMEM);
+    check_select();
+    return test_finish();
+}
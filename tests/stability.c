@@ -0,0 +1,220 @@
+/**
+ * @file stability.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Randomized stability tests for `xsort`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Every entry point of the core sorts must reproduce the stable order of
+ * packed keys exactly. Records wider than 64 bits and doubles are checked
+ * the same way against a reference that breaks ties on the original index.
+ *
+ * Usage: stability [seed]
+ *
+ */
+
+#include <math.h>
+
+#include "test.h"
+
+
+// Cache sizes small enough that `XSORT_FLAG_BLOCKED` takes effect on the
+// larger inputs below
+#define TEST_CACHE_L1 (16 << 10)
+#define TEST_CACHE_L2 (64 << 10)
+
+// Parallel sorts only split inputs beyond a threshold, so they also get these
+static const size_t parallel_sizes[] = { 1000, 70001, 300000, 1 << 20 };
+
+
+#pragma region Checks
+
+static void check_ws(unsigned flags)
+{
+    char what[64];
+    snprintf(what, sizeof(what), "xsort_ws%s%s%s", flags & XSORT_FLAG_GALLOP ? " gallop" : "",
+        flags & XSORT_FLAG_LOWMEM ? " lowmem" : "", flags & XSORT_FLAG_BLOCKED ? " blocked" : "");
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        uint64_t *elems = malloc((n + 1) * sizeof(uint64_t));
+        uint64_t *expected = malloc((n + 1) * sizeof(uint64_t));
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                fill(elems, n, &patterns[p], ranges[r]);
+                memcpy(expected, elems, n * sizeof(uint64_t));
+                reference(expected, n);
+                xsort_ws(elems, n, cmp_key, NULL, &ws);
+                expect(sorted_stably(elems, expected, n), "%s: %s keys, range %" PRIu32 ", %zu elements", what, patterns[p].name, ranges[r], n);
+            }
+        }
+        free(elems);
+        free(expected);
+    }
+    xsort_workspace_destroy(&ws);
+}
+
+static void check_parallel(size_t nthreads)
+{
+    char what[64];
+    snprintf(what, sizeof(what), "xsort_parallel %zu threads", nthreads);
+
+    for (size_t s = 0; s < COUNT(parallel_sizes); s++) {
+        size_t n = parallel_sizes[s];
+        uint64_t *elems = malloc(n * sizeof(uint64_t));
+        uint64_t *expected = malloc(n * sizeof(uint64_t));
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                fill(elems, n, &patterns[p], ranges[r]);
+                memcpy(expected, elems, n * sizeof(uint64_t));
+                reference(expected, n);
+                xsort_parallel(elems, n, cmp_key, NULL, nthreads);
+                expect(sorted_stably(elems, expected, n), "%s: %s keys, range %" PRIu32 ", %zu elements", what, patterns[p].name, ranges[r], n);
+            }
+        }
+        free(elems);
+        free(expected);
+    }
+}
+
+static void check_sized(size_t size)
+{
+    char what[64];
+    snprintf(what, sizeof(what), "xsort_sized %zu bytes", size);
+
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        uint64_t *packed = malloc((n + 1) * sizeof(uint64_t));
+        uint8_t *records = malloc((n + 1) * size);
+        uint8_t *expected = malloc((n + 1) * size);
+        for (size_t p = 0; p < COUNT(patterns); p++) {
+            for (size_t r = 0; r < COUNT(ranges); r++) {
+                fill(packed, n, &patterns[p], ranges[r]);
+                for (size_t i = 0; i < n; i++) {
+                    record_build(&records[i * size], size, packed[i]);
+                }
+                reference(packed, n);
+                for (size_t i = 0; i < n; i++) {
+                    record_build(&expected[i * size], size, packed[i]);
+                }
+                bool ok = !xsort_sized(records, n, size, cmp_record, NULL);
+                expect(ok && (!n || !memcmp(records, expected, n * size)), "%s: %s keys, range %" PRIu32 ", %zu elements", what, patterns[p].name, ranges[r], n);
+            }
+        }
+        free(packed);
+        free(records);
+        free(expected);
+    }
+}
+
+// Doubles whose order is only visible through their bits: both zeros, and
+// NaNs of either sign carrying their original index as payload
+typedef struct f64_ref_t {
+    double value;
+    size_t index;
+} f64_ref_t;
+
+static double f64_draw(size_t i)
+{
+    uint64_t nan = UINT64_C(0x7ff8000000000000) | (i & 0xffffffff);
+    double value;
+    switch (rng() % 8) {
+        case 0:
+        case 1:
+            return 0.0;
+        case 2:
+        case 3:
+            return -0.0;
+        case 4:
+            nan |= rng() & 1 ? UINT64_C(1) << 63 : 0;
+            memcpy(&value, &nan, sizeof(value));
+            return value;
+        case 5:
+            return (double)(rng() % 4) - 2;
+        case 6:
+            return rng() & 1 ? INFINITY : -INFINITY;
+        default:
+            return ldexp((double)(rng() % 1000) - 500, (int)(rng() % 20) - 10);
+    }
+}
+
+// NaNs after everything else, -0.0 equal to +0.0, ties on the index
+static int cmp_f64_ref(const void *a, const void *b)
+{
+    const f64_ref_t *x = a;
+    const f64_ref_t *y = b;
+    bool x_nan = isnan(x->value);
+    bool y_nan = isnan(y->value);
+    if (x_nan != y_nan) {
+        return x_nan - y_nan;
+    }
+    if (!x_nan && x->value != y->value) {
+        return x->value < y->value ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static void check_f64(unsigned flags)
+{
+    const char *what = flags & XSORT_FLAG_LOWMEM ? "xsort_f64_ws lowmem" : "xsort_f64_ws";
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    ws.flags = flags;
+    for (size_t s = 0; s < COUNT(test_sizes); s++) {
+        size_t n = test_sizes[s];
+        double *values = malloc((n + 1) * sizeof(double));
+        f64_ref_t *refs = malloc((n + 1) * sizeof(f64_ref_t));
+        double *expected = malloc((n + 1) * sizeof(double));
+        for (size_t round = 0; round < 8; round++) {
+            for (size_t i = 0; i < n; i++) {
+                values[i] = f64_draw(i);
+                refs[i] = (f64_ref_t) { .value = values[i], .index = i };
+            }
+            qsort(refs, n, sizeof(f64_ref_t), cmp_f64_ref);
+            for (size_t i = 0; i < n; i++) {
+                expected[i] = refs[i].value;
+            }
+            xsort_f64_ws(values, n, &ws);
+            expect(!n || !memcmp(values, expected, n * sizeof(double)), "%s: zeros and NaNs, %zu elements", what, n);
+        }
+        free(values);
+        free(refs);
+        free(expected);
+    }
+    xsort_workspace_destroy(&ws);
+}
+
+#pragma endregion
+
+
+int main(int argc, char **argv)
+{
+    test_begin(argc, argv);
+    xsort_set_cache(&(xsort_cache_t) { .l1 = TEST_CACHE_L1, .l2 = TEST_CACHE_L2 });
+
+    const unsigned all = XSORT_FLAG_GALLOP | XSORT_FLAG_LOWMEM | XSORT_FLAG_BLOCKED;
+    for (unsigned flags = 0; flags <= all; flags++) {
+        check_ws(flags);
+    }
+
+    const size_t threads[] = { 1, 2, 4, 0 };
+    for (size_t i = 0; i < COUNT(threads); i++) {
+        check_parallel(threads[i]);
+    }
+
+    const size_t widths[] = { 8, 12, 16, 24, 32, 40, 56 };
+    for (size_t i = 0; i < COUNT(widths); i++) {
+        check_sized(widths[i]);
+    }
+
+    check_f64(0);
+    check_f64(XSORT_FLAG_LOWMEM);
+
+    return test_finish();
+}
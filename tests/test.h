@@ -0,0 +1,219 @@
+/**
+ * @file test.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Shared inputs, references and reporting for the `xsort` tests
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Each test is a program of its own taking an optional seed. Elements pack
+ * a key drawn from a small range above their original index, and only the
+ * key is compared. Sorting the packed values outright then gives the one
+ * stable order, which the code under test must reproduce exactly.
+ *
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdarg.h>
+
+#include "xsort.h"
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// Lengths most tests run through: the empty and tiny cases, either side of
+// the engine's small-segment and block sizes, and a few longer inputs
+static __unused const size_t test_sizes[] = { 0, 1, 2, 3, 7, 8, 9, 31, 32, 33, 100, 257, 1000, 4097, 20000, 70001 };
+
+static const char *test_name;
+static size_t test_checks;
+static size_t test_failures;
+
+
+#pragma region Reporting
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static inline uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Take the seed from the command line, if given, and announce it
+static inline void test_begin(int argc, char **argv)
+{
+    test_name = argv[0];
+    if (argc > 1) {
+        rng_state = strtoull(argv[1], NULL, 0) | 1;
+    }
+    printf("%s: seed %#" PRIx64 "\n", test_name, rng_state);
+}
+
+// Count one check, describing it on failure
+static inline void expect(bool ok, const char *fmt, ...)
+{
+    test_checks++;
+    if (!ok) {
+        test_failures++;
+        va_list args;
+        va_start(args, fmt);
+        printf("%s: FAIL ", test_name);
+        vprintf(fmt, args);
+        putchar('\n');
+        va_end(args);
+    }
+}
+
+// Report the totals, returning the exit status for `main()`
+static inline int test_finish(void)
+{
+    printf("%s: %zu checks, %zu failures\n", test_name, test_checks, test_failures);
+    return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#pragma endregion
+
+
+#pragma region Inputs
+
+typedef struct pattern_t {
+    const char *name;
+    uint32_t (*key)(size_t i, size_t n, uint32_t range);
+} pattern_t;
+
+static inline uint32_t key_random(size_t i, size_t n, uint32_t range)
+{
+    (void)i;
+    (void)n;
+    return (uint32_t)(rng() % range);
+}
+
+static inline uint32_t key_ascending(size_t i, size_t n, uint32_t range)
+{
+    return (uint32_t)(i * range / (n + 1));
+}
+
+static inline uint32_t key_descending(size_t i, size_t n, uint32_t range)
+{
+    return range - 1 - key_ascending(i, n, range);
+}
+
+static inline uint32_t key_sawtooth(size_t i, size_t n, uint32_t range)
+{
+    (void)n;
+    return (uint32_t)(i % range);
+}
+
+// Alternating ascending and descending runs of random length
+static inline uint32_t key_runs(size_t i, size_t n, uint32_t range)
+{
+    static size_t left;
+    static bool down;
+    if (!i || !left) {
+        left = 1 + (size_t)(rng() % (n / 4 + 1));
+        down = rng() & 1;
+    }
+    left--;
+    uint32_t key = (uint32_t)(left % range);
+    return down ? key : range - 1 - key;
+}
+
+// Mostly sorted, with a few random keys scattered through
+static inline uint32_t key_nearly(size_t i, size_t n, uint32_t range)
+{
+    return rng() % 64 ? key_ascending(i, n, range) : key_random(i, n, range);
+}
+
+static __unused const pattern_t patterns[] = {
+    { "random", key_random },
+    { "ascending", key_ascending },
+    { "descending", key_descending },
+    { "sawtooth", key_sawtooth },
+    { "runs", key_runs },
+    { "nearly", key_nearly },
+};
+
+// Key ranges, all small enough to produce long runs of equal keys
+static __unused const uint32_t ranges[] = { 1, 2, 7, 100 };
+
+static inline uint64_t pack(uint32_t key, size_t index)
+{
+    return (uint64_t)key << 32 | (uint32_t)index;
+}
+
+static inline uint32_t key_of(uint64_t elem)
+{
+    return (uint32_t)(elem >> 32);
+}
+
+// Fill `elems` with keys above their original index
+static inline void fill(uint64_t *elems, size_t n, const pattern_t *pattern, uint32_t range)
+{
+    for (size_t i = 0; i < n; i++) {
+        elems[i] = pack(pattern->key(i, n, range), i);
+    }
+}
+
+// Records of `size` bytes, at least 8, hold a 32-bit key, then their
+// original index, then filler bytes derived from the index so that torn
+// moves are caught too
+static inline void record_build(uint8_t *record, size_t size, uint64_t packed)
+{
+    uint32_t key = key_of(packed);
+    uint32_t index = (uint32_t)packed;
+    memcpy(record, &key, sizeof(key));
+    memcpy(record + 4, &index, sizeof(index));
+    for (size_t j = 8; j < size; j++) {
+        record[j] = (uint8_t)(index * 31 + j);
+    }
+}
+
+#pragma endregion
+
+
+#pragma region Reference
+
+static inline int cmp_packed(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// The comparator under test, which only sees the key
+static inline ptrdiff_t cmp_key(const void *a, const void *b, void *arg)
+{
+    (void)arg;
+    uint32_t x = key_of(*(const uint64_t *)a);
+    uint32_t y = key_of(*(const uint64_t *)b);
+    return (x > y) - (x < y);
+}
+
+static inline ptrdiff_t cmp_record(const void *a, const void *b, void *arg)
+{
+    (void)arg;
+    uint32_t x;
+    uint32_t y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+}
+
+// Packed values are distinct, so any sort of them is the stable order
+static inline void reference(uint64_t *elems, size_t n)
+{
+    qsort(elems, n, sizeof(uint64_t), cmp_packed);
+}
+
+// Whether `elems` is the stable sort of the packed input it was made from
+static inline bool sorted_stably(const uint64_t *elems, const uint64_t *expected, size_t n)
+{
+    return !n || !memcmp(elems, expected, n * sizeof(uint64_t));
+}
+
+#pragma endregion
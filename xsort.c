@@ -10,279 +10,1689 @@
  */
 
 #include "xsort.h"
+#include "xsort_compat.h"
+#include "xsort_merge.h"
+#include "xsort_radix.h"
+#include "xsort_pages.h"
+#include "xsort_simd.h"
+#include "xsort_stats.h"
+
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
+#ifdef XSORT_STATS
+_Thread_local xsort_stats_t *xsort_stats_sink;
+_Thread_local xsort_phase_t xsort_stats_phase;
+#endif
 
 
 #pragma region Allocator
 
-static void *xmalloc(size_t size)
+// Allocate through `allocator`, or the C library if it is NULL.
+// Returns NULL with `errno` set to `ENOMEM` on failure
+static void *xmalloc(const xsort_allocator_t *allocator, size_t size)
+{
+    void *ptr = allocator ? allocator->alloc(size, allocator->ctx) : malloc(size);
+    if (unlikely(!ptr)) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+static void xfree(const xsort_allocator_t *allocator, void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    if (allocator) {
+        allocator->release(ptr, allocator->ctx);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+#pragma endregion
+
+
+#pragma region Cache
+
+#define CACHE_DEFAULT_L1 (32 << 10)
+#define CACHE_DEFAULT_L2 (1 << 20)
+
+static xsort_cache_t cache_sizes;
+static bool cache_probed;
+
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+static size_t cache_query(int name, size_t fallback)
+{
+    long size = sysconf(name);
+    return size > 0 ? (size_t)size : fallback;
+}
+#endif
+
+const xsort_cache_t *xsort_cache(void)
+{
+    if (unlikely(!xsort_flag_load(&cache_probed))) {
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+        cache_sizes = (xsort_cache_t) {
+            .l1 = cache_query(_SC_LEVEL1_DCACHE_SIZE, CACHE_DEFAULT_L1),
+            .l2 = cache_query(_SC_LEVEL2_CACHE_SIZE, CACHE_DEFAULT_L2),
+        };
+#else
+        cache_sizes = (xsort_cache_t) { .l1 = CACHE_DEFAULT_L1, .l2 = CACHE_DEFAULT_L2 };
+#endif
+        xsort_flag_store(&cache_probed, true);
+    }
+    return &cache_sizes;
+}
+
+void xsort_set_cache(const xsort_cache_t *cache)
+{
+    cache_sizes = *cache;
+    xsort_flag_store(&cache_probed, true);
+}
+
+#pragma endregion
+
+
+// Comparator and argument threaded through the engine as its `arg`
+typedef struct cmp_ctx_t {
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} cmp_ctx_t;
+
+#define XSORT_NAME sort_ctx
+#define XSORT_TYPE uint64_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#include "xsort_template.h"
+
+// Same ordering as `sort_ctx`, minimising comparator calls on skewed merges
+#define XSORT_NAME sort_ctx_gallop
+#define XSORT_TYPE uint64_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#define XSORT_GALLOP
+#include "xsort_template.h"
+
+// Byte-aligned records of common widths, sorted by value with the same
+// comparator convention as `sort_ctx`
+typedef struct elem4_t { uint8_t bytes[4]; } elem4_t;
+typedef struct elem8_t { uint8_t bytes[8]; } elem8_t;
+typedef struct elem16_t { uint8_t bytes[16]; } elem16_t;
+typedef struct elem32_t { uint8_t bytes[32]; } elem32_t;
+
+#define XSORT_NAME sort_ctx4
+#define XSORT_TYPE elem4_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#include "xsort_template.h"
+
+#define XSORT_NAME sort_ctx8
+#define XSORT_TYPE elem8_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#include "xsort_template.h"
+
+#define XSORT_NAME sort_ctx16
+#define XSORT_TYPE elem16_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#include "xsort_template.h"
+
+#define XSORT_NAME sort_ctx32
+#define XSORT_TYPE elem32_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#include "xsort_template.h"
+
+// Pointers to records of any other width, compared through the pointee
+typedef uint8_t *elem_ref_t;
+
+#define XSORT_NAME sort_ctx_indirect
+#define XSORT_TYPE elem_ref_t
+#define XSORT_LESS(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp(*(a), *(b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+#include "xsort_template.h"
+
+// Hand a parity merge of integer keys to the vectorized kernel, if any.
+// Small merges stay scalar, where the kernel's scalar tail would dominate
+static inline bool simd_merge(const int64_t *src, int64_t *dst, size_t left, size_t right, uint64_t bias)
+{
+    const simd_kernels_t *kernels = simd_kernels();
+    if (!kernels->merge || left < 4 * kernels->merge_min) {
+        return false;
+    }
+    kernels->merge(&src[0], left, &src[left], right, dst, bias);
+    return true;
+}
+
+// Integer keys hand small segments to a vectorized sorting network and
+// larger merges to a vectorized merge when the processor has them; equal
+// keys are indistinguishable, so neither being stable is unobservable
+#define XSORT_NAME sort_u64
+#define XSORT_TYPE uint64_t
+#define XSORT_LESS(a, b, arg) (*(a) < *(b))
+#define XSORT_LEAF_MAX simd_kernels()->sort_max
+#define XSORT_LEAF(data, elements, arg) simd_kernels()->sort((int64_t *)(data), (elements), UINT64_C(1) << 63)
+#define XSORT_MERGE(src, dst, left, right, arg) simd_merge((int64_t *)(src), (int64_t *)(dst), (left), (right), UINT64_C(1) << 63)
+#include "xsort_template.h"
+
+#define XSORT_NAME sort_i64
+#define XSORT_TYPE int64_t
+#define XSORT_LESS(a, b, arg) (*(a) < *(b))
+#define XSORT_LEAF_MAX simd_kernels()->sort_max
+#define XSORT_LEAF(data, elements, arg) simd_kernels()->sort((data), (elements), 0)
+#define XSORT_MERGE(src, dst, left, right, arg) simd_merge((src), (dst), (left), (right), 0)
+#include "xsort_template.h"
+
+// The network would reorder values that compare equal yet differ, such as
+// -0.0 and +0.0, so doubles always use the stable odd-even leaves.
+// NaNs order after every other value and compare equal to one another
+#define XSORT_NAME sort_f64
+#define XSORT_TYPE double
+#define XSORT_LESS(a, b, arg) ((*(a) < *(b)) | ((*(b) != *(b)) & (*(a) == *(a))))
+#include "xsort_template.h"
+
+// Element paired with its extracted key. Keys are compared inline and the
+// comparator is only consulted between elements whose keys are equal
+typedef struct keyed_t {
+    uint64_t key;
+    uint64_t value;
+} keyed_t;
+
+static inline bool keyed_tie(const keyed_t *a, const keyed_t *b, const cmp_ctx_t *ctx)
+{
+    return ctx->cmp && ctx->cmp(&a->value, &b->value, ctx->arg) < 0;
+}
+
+#define XSORT_NAME sort_keyed
+#define XSORT_TYPE keyed_t
+#define XSORT_LESS(a, b, ctx) ((a)->key < (b)->key || ((a)->key == (b)->key && keyed_tie((a), (b), (ctx))))
+#include "xsort_template.h"
+
+// Index packed below the high half of its element's key. Prefixes are
+// compared inline, and elements whose prefixes collide are told apart by
+// their full keys, then by the comparator
+typedef struct argkey_ctx_t {
+    const uint64_t *keys;
+    xsort_key_fn_t key;
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} argkey_ctx_t;
+
+static inline bool argkey_tie(uint64_t a, uint64_t b, const argkey_ctx_t *ctx)
+{
+    const uint64_t *x = &ctx->keys[a & UINT32_MAX];
+    const uint64_t *y = &ctx->keys[b & UINT32_MAX];
+    uint64_t kx = ctx->key(x, ctx->arg);
+    uint64_t ky = ctx->key(y, ctx->arg);
+    if (kx != ky) {
+        return kx < ky;
+    }
+    return ctx->cmp && ctx->cmp(x, y, ctx->arg) < 0;
+}
+
+#define XSORT_NAME sort_argkey
+#define XSORT_TYPE uint64_t
+#define XSORT_LESS(a, b, ctx) ((*(a) >> 32) < (*(b) >> 32) || ((*(a) >> 32) == (*(b) >> 32) && argkey_tie(*(a), *(b), (ctx))))
+#include "xsort_template.h"
+
+
+#pragma region Workspace
+
+// Smallest scratch buffer, in elements, used under `XSORT_FLAG_LOWMEM`
+#define LOWMEM_MIN_BUFFER 512
+
+// Size of the on-stack buffer sorts fall back to when the workspace
+// cannot grow at all, in 64-bit slots
+#define LOWMEM_STACK_SLOTS 512
+
+void xsort_workspace_init(xsort_workspace_t *ws)
+{
+    *ws = (xsort_workspace_t) { 0 };
+}
+
+int xsort_workspace_reserve(xsort_workspace_t *ws, size_t elements)
+{
+    if (ws->swap_capacity >= elements) {
+        return 0;
+    }
+    if (unlikely(elements > SIZE_MAX / sizeof(uint64_t))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // The current buffer is only released once its replacement exists,
+    // so a failed reservation leaves the workspace as it was. Mappings
+    // that fail fall back to the allocator
+    size_t bytes = elements * sizeof(uint64_t);
+    size_t mapped = 0;
+    uint64_t *swap = NULL;
+    if ((ws->flags & XSORT_FLAG_HUGEPAGES) && !ws->allocator && bytes >= PAGES_HUGE_MIN) {
+        swap = pages_map(bytes, &mapped);
+    }
+    if (!swap) {
+        mapped = 0;
+        swap = xmalloc(ws->allocator, bytes);
+    }
+    if (unlikely(!swap)) {
+        return -1;
+    }
+    xsort_workspace_destroy(ws);
+    ws->swap = swap;
+    ws->swap_capacity = elements;
+    ws->swap_mapped = mapped;
+    return 0;
+}
+
+void xsort_workspace_destroy(xsort_workspace_t *ws)
+{
+    if (ws->swap_mapped) {
+        pages_unmap(ws->swap, ws->swap_mapped);
+    }
+    else {
+        xfree(ws->allocator, ws->swap);
+    }
+    ws->swap = NULL;
+    ws->swap_capacity = 0;
+    ws->swap_mapped = 0;
+}
+
+#pragma endregion
+
+
+// Scratch elements used under `XSORT_FLAG_LOWMEM`: the first power of two
+// at or above the square root of `elements`, and at least `LOWMEM_MIN_BUFFER`
+static size_t lowmem_capacity(size_t elements)
+{
+    size_t cap = LOWMEM_MIN_BUFFER;
+    while (cap < elements / cap) {
+        cap *= 2;
+    }
+    return cap;
+}
+
+// Reserve room for `elements` records of `size` bytes in `ws`
+static int reserve_records(xsort_workspace_t *ws, size_t elements, size_t size)
+{
+    if (unlikely(elements > SIZE_MAX / size - sizeof(uint64_t))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return xsort_workspace_reserve(ws, (elements * size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+}
+
+// Choose scratch memory for sorting `elements` records of `size` bytes and
+// return its capacity in records, storing its address in `*swap`. A full
+// copy of the array is preferred unless `XSORT_FLAG_LOWMEM` is set. When
+// the workspace cannot provide one, a low-memory buffer is tried next, and
+// failing that the caller's `fallback` of `LOWMEM_STACK_SLOTS` slots. A
+// capacity below `elements` therefore means the sort must run in low-memory
+// mode. A full copy that was mapped is moved to the NUMA node of `data`
+static size_t acquire_scratch(xsort_workspace_t *ws, const void *data, size_t elements, size_t size, uint64_t *fallback, void **swap)
+{
+    if (!(ws->flags & XSORT_FLAG_LOWMEM) && !reserve_records(ws, elements, size)) {
+        if (ws->swap_mapped) {
+            pages_bind_near(ws->swap, ws->swap_mapped, data);
+        }
+        *swap = ws->swap;
+        return elements;
+    }
+
+    size_t cap = lowmem_capacity(elements);
+    cap = cap < elements ? cap : elements;
+    if (!reserve_records(ws, cap, size)) {
+        *swap = ws->swap;
+        return cap;
+    }
+
+    cap = LOWMEM_STACK_SLOTS * sizeof(uint64_t) / size;
+    *swap = fallback;
+    return cap < elements ? cap : elements;
+}
+
+void xsort_ws(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+    uint64_t fallback[LOWMEM_STACK_SLOTS];
+    void *swap;
+    size_t cap = acquire_scratch(ws, ptr, elements, sizeof(uint64_t), fallback, &swap);
+
+    xsort_stats_attach(ws->stats);
+    bool blocked = ws->flags & XSORT_FLAG_BLOCKED;
+    if (ws->flags & XSORT_FLAG_GALLOP) {
+        if (cap < elements) {
+            sort_ctx_gallop_lowmem(ptr, elements, swap, cap, &ctx);
+        }
+        else if (blocked) {
+            sort_ctx_gallop_blocked(ptr, elements, swap, &ctx);
+        }
+        else {
+            sort_ctx_gallop(ptr, elements, swap, &ctx);
+        }
+    }
+    else {
+        if (cap < elements) {
+            sort_ctx_lowmem(ptr, elements, swap, cap, &ctx);
+        }
+        else if (blocked) {
+            sort_ctx_blocked(ptr, elements, swap, &ctx);
+        }
+        else {
+            sort_ctx(ptr, elements, swap, &ctx);
+        }
+    }
+    xsort_stats_attach(NULL);
+}
+
+// Sort records of arbitrary width by sorting pointers to them, then
+// moving each record into place by following the permutation's cycles
+static int sort_indirect(uint8_t *data, size_t elements, size_t size, cmp_ctx_t *ctx, xsort_workspace_t *ws)
+{
+    // Already in order, so there is nothing to reserve the references for
+    if (elements < 2) {
+        return 0;
+    }
+    size_t slots = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    if (unlikely(elements > (SIZE_MAX / sizeof(uint64_t) - slots) / 2) || xsort_workspace_reserve(ws, 2 * elements + slots)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uint8_t **ref = (uint8_t **)&ws->swap[0];
+    uint8_t **swap = (uint8_t **)&ws->swap[elements];
+    uint8_t *tmp = (uint8_t *)&ws->swap[2 * elements];
+
+    for (size_t i = 0; i < elements; i++) {
+        ref[i] = &data[i * size];
+    }
+
+    sort_ctx_indirect(ref, elements, swap, ctx);
+
+    for (size_t i = 0; i < elements; i++) {
+        if (ref[i] == &data[i * size]) {
+            continue;
+        }
+        memcpy(tmp, &data[i * size], size);
+        size_t j = i;
+        while (ref[j] != &data[i * size]) {
+            size_t k = (size_t)(ref[j] - data) / size;
+            memcpy(&data[j * size], ref[j], size);
+            ref[j] = &data[j * size];
+            j = k;
+        }
+        memcpy(&data[j * size], tmp, size);
+        ref[j] = &data[j * size];
+    }
+    return 0;
+}
+
+static int sort_sized(void *ptr, size_t elements, size_t size, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+
+    if (size != 4 && size != 8 && size != 16 && size != 32) {
+        return sort_indirect(ptr, elements, size, &ctx, ws);
+    }
+
+    uint64_t fallback[LOWMEM_STACK_SLOTS];
+    void *swap;
+    size_t cap = acquire_scratch(ws, ptr, elements, size, fallback, &swap);
+
+    if (cap < elements) {
+        switch (size) {
+            case 4:
+                sort_ctx4_lowmem(ptr, elements, swap, cap, &ctx);
+                break;
+            case 8:
+                sort_ctx8_lowmem(ptr, elements, swap, cap, &ctx);
+                break;
+            case 16:
+                sort_ctx16_lowmem(ptr, elements, swap, cap, &ctx);
+                break;
+            case 32:
+                sort_ctx32_lowmem(ptr, elements, swap, cap, &ctx);
+                break;
+        }
+        return 0;
+    }
+
+    switch (size) {
+        case 4:
+            sort_ctx4(ptr, elements, swap, &ctx);
+            break;
+        case 8:
+            sort_ctx8(ptr, elements, swap, &ctx);
+            break;
+        case 16:
+            sort_ctx16(ptr, elements, swap, &ctx);
+            break;
+        case 32:
+            sort_ctx32(ptr, elements, swap, &ctx);
+            break;
+    }
+    return 0;
+}
+
+int xsort_sized_ws(void *ptr, size_t elements, size_t size, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    xsort_stats_attach(ws->stats);
+    int status = sort_sized(ptr, elements, size, cmp, arg, ws);
+    xsort_stats_attach(NULL);
+    return status;
+}
+
+int xsort_sized(void *ptr, size_t elements, size_t size, cmp_ctx_fn_t cmp, void *arg)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    int status = xsort_sized_ws(ptr, elements, size, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+    return status;
+}
+
+void xsort(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_ws(ptr, elements, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+int xmerge_k(const void *const runs[], const size_t lengths[], size_t k, void *dst, cmp_ctx_fn_t cmp, void *arg)
+{
+    uint64_t *out = dst;
+    if (!k) {
+        return 0;
+    }
+
+    // Drop empty runs up front so they never occupy a leaf
+    const void **head = xmalloc(NULL, 2 * k * sizeof(void *));
+    if (unlikely(!head)) {
+        return -1;
+    }
+    const void **end = &head[k];
+    size_t n = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (lengths[i]) {
+            head[n] = runs[i];
+            end[n++] = (const uint64_t *)runs[i] + lengths[i];
+        }
+    }
+
+    if (n <= 2) {
+        if (n == 1) {
+            memcpy(out, head[0], (size_t)((const uint8_t *)end[0] - (const uint8_t *)head[0]));
+        }
+        else if (n == 2) {
+            size_t nl = (size_t)((const uint64_t *)end[0] - (const uint64_t *)head[0]);
+            size_t nr = (size_t)((const uint64_t *)end[1] - (const uint64_t *)head[1]);
+            sort_ctx_merge(head[0], nl, head[1], nr, out, &(cmp_ctx_t) { .cmp = cmp, .arg = arg });
+        }
+        xfree(NULL, head);
+        return 0;
+    }
+
+    loser_tree_t lt;
+    if (unlikely(!loser_tree_init(&lt, head, n, cmp, arg))) {
+        xfree(NULL, head);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (;;) {
+        size_t top = loser_tree_top(&lt);
+        if (!head[top]) {
+            break;
+        }
+        const uint64_t *next = head[top];
+        *out++ = *next++;
+        head[top] = next == end[top] ? NULL : next;
+        loser_tree_replay(&lt);
+    }
+    loser_tree_destroy(&lt);
+
+    xfree(NULL, head);
+    return 0;
+}
+
+#pragma region Key-only
+
+static void radix_leaf_u64(uint64_t *data, size_t elements, uint64_t *swap)
+{
+    sort_u64(data, elements, swap, NULL);
+}
+
+static void radix_leaf_i64(uint64_t *data, size_t elements, uint64_t *swap)
+{
+    sort_i64((int64_t *)data, elements, (int64_t *)swap, NULL);
+}
+
+static void radix_leaf_f64(uint64_t *data, size_t elements, uint64_t *swap)
+{
+    sort_f64((double *)data, elements, (double *)swap, NULL);
+}
+
+// Radix sort `ptr` in the workspace's swap buffer when `radix_plan()`
+// favours it. Returns false, leaving the array untouched, if the input is
+// better merged or the swap and histograms cannot be reserved
+static bool sort_radix(uint64_t *ptr, size_t elements, radix_kind_t kind, radix_leaf_fn_t leaf, xsort_workspace_t *ws)
+{
+    if (ws->flags & XSORT_FLAG_LOWMEM) {
+        return false;
+    }
+
+    radix_plan_t plan = radix_plan(ptr, elements, kind);
+    if (plan.method == RADIX_NONE) {
+        return false;
+    }
+
+    // LSD histograms live in the swap buffer, just past the elements
+    size_t hist = 0;
+    if (plan.method == RADIX_LSD) {
+        hist = (size_t)((plan.hi - plan.lo + plan.bits - 1) / plan.bits) << plan.bits;
+    }
+    if (elements > SIZE_MAX / sizeof(uint64_t) - hist || xsort_workspace_reserve(ws, elements + hist)) {
+        return false;
+    }
+    // Every pass streams the whole input through the swap buffer, so a
+    // mapped one is kept on the same node as the input, as for the merges
+    if (ws->swap_mapped) {
+        pages_bind_near(ws->swap, ws->swap_mapped, ptr);
+    }
+
+    if (plan.method == RADIX_LSD) {
+        radix_lsd(ptr, ws->swap, (size_t *)&ws->swap[elements], elements, &plan, kind);
+    }
+    else {
+        unsigned shift = plan.hi > RADIX_MSD_BITS ? plan.hi - RADIX_MSD_BITS : 0;
+        radix_msd(ptr, ws->swap, elements, shift, plan.lo, false, kind, leaf);
+    }
+    return true;
+}
+
+void xsort_u64_ws(uint64_t *ptr, size_t elements, xsort_workspace_t *ws)
+{
+    uint64_t fallback[LOWMEM_STACK_SLOTS];
+    void *swap;
+    xsort_stats_attach(ws->stats);
+    if (sort_radix(ptr, elements, RADIX_U64, radix_leaf_u64, ws)) {
+        xsort_stats_attach(NULL);
+        return;
+    }
+
+    size_t cap = acquire_scratch(ws, ptr, elements, sizeof(uint64_t), fallback, &swap);
+    if (cap < elements) {
+        sort_u64_lowmem(ptr, elements, swap, cap, NULL);
+    }
+    else {
+        sort_u64(ptr, elements, swap, NULL);
+    }
+    xsort_stats_attach(NULL);
+}
+
+void xsort_i64_ws(int64_t *ptr, size_t elements, xsort_workspace_t *ws)
+{
+    uint64_t fallback[LOWMEM_STACK_SLOTS];
+    void *swap;
+    xsort_stats_attach(ws->stats);
+    if (sort_radix((uint64_t *)ptr, elements, RADIX_I64, radix_leaf_i64, ws)) {
+        xsort_stats_attach(NULL);
+        return;
+    }
+
+    size_t cap = acquire_scratch(ws, ptr, elements, sizeof(int64_t), fallback, &swap);
+    if (cap < elements) {
+        sort_i64_lowmem(ptr, elements, swap, cap, NULL);
+    }
+    else {
+        sort_i64(ptr, elements, swap, NULL);
+    }
+    xsort_stats_attach(NULL);
+}
+
+void xsort_f64_ws(double *ptr, size_t elements, xsort_workspace_t *ws)
+{
+    uint64_t fallback[LOWMEM_STACK_SLOTS];
+    void *swap;
+    xsort_stats_attach(ws->stats);
+    if (sort_radix((uint64_t *)ptr, elements, RADIX_F64, radix_leaf_f64, ws)) {
+        xsort_stats_attach(NULL);
+        return;
+    }
+
+    size_t cap = acquire_scratch(ws, ptr, elements, sizeof(double), fallback, &swap);
+    if (cap < elements) {
+        sort_f64_lowmem(ptr, elements, swap, cap, NULL);
+    }
+    else {
+        sort_f64(ptr, elements, swap, NULL);
+    }
+    xsort_stats_attach(NULL);
+}
+
+void xsort_u64(uint64_t *ptr, size_t elements)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_u64_ws(ptr, elements, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+void xsort_i64(int64_t *ptr, size_t elements)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_i64_ws(ptr, elements, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+void xsort_f64(double *ptr, size_t elements)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_f64_ws(ptr, elements, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+#pragma endregion
+
+
+#pragma region Batch
+
+// Network sizes the interleaved kernels are grouped by, from 2 to 32 keys
+#define BATCH_CLASSES 5
+
+// Widest register, in 64-bit lanes, of any interleaved kernel
+#define BATCH_MAX_LANES 8
+
+// Reserve scratch for the longest array up front, so each sort finds it ready
+static void batch_reserve(const size_t lengths[], size_t count, xsort_workspace_t *ws)
+{
+    size_t longest = 0;
+    for (size_t i = 0; i < count; i++) {
+        longest = lengths[i] > longest ? lengths[i] : longest;
+    }
+    if (!(ws->flags & XSORT_FLAG_LOWMEM)) {
+        xsort_workspace_reserve(ws, longest);
+    }
+}
+
+void xsort_batch_ws(void *const arrays[], const size_t lengths[], size_t count, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    batch_reserve(lengths, count, ws);
+    for (size_t i = 0; i < count; i++) {
+        xsort_ws(arrays[i], lengths[i], cmp, arg, ws);
+    }
+}
+
+void xsort_batch(void *const arrays[], const size_t lengths[], size_t count, cmp_ctx_fn_t cmp, void *arg)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_batch_ws(arrays, lengths, count, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+// Sort integer arrays through the interleaved network where they fit.
+// Arrays are grouped by the network size they pad to, and a group is
+// sorted once it fills every lane; longer arrays, and every array when
+// there is no such kernel, go to `sort_one` individually
+static void batch_keys(int64_t *const arrays[], const size_t lengths[], size_t count, uint64_t bias, void (*sort_one)(int64_t *, size_t, xsort_workspace_t *), xsort_workspace_t *ws)
+{
+    const simd_kernels_t *kernels = simd_kernels();
+    int64_t *group[BATCH_CLASSES][BATCH_MAX_LANES];
+    size_t group_len[BATCH_CLASSES][BATCH_MAX_LANES];
+    size_t fill[BATCH_CLASSES] = { 0 };
+
+    batch_reserve(lengths, count, ws);
+    for (size_t i = 0; i < count; i++) {
+        size_t n = lengths[i];
+        if (n < 2) {
+            continue;
+        }
+        if (!kernels->batch || n > kernels->batch_max) {
+            sort_one(arrays[i], n, ws);
+            continue;
+        }
+
+        size_t c = 0;
+        while ((size_t)2 << c < n) {
+            c++;
+        }
+        group[c][fill[c]] = arrays[i];
+        group_len[c][fill[c]] = n;
+        if (++fill[c] == kernels->batch_lanes) {
+            kernels->batch(group[c], group_len[c], fill[c], (size_t)2 << c, bias);
+            fill[c] = 0;
+        }
+    }
+
+    for (size_t c = 0; c < BATCH_CLASSES; c++) {
+        if (fill[c]) {
+            kernels->batch(group[c], group_len[c], fill[c], (size_t)2 << c, bias);
+        }
+    }
+}
+
+static void batch_one_u64(int64_t *data, size_t elements, xsort_workspace_t *ws)
+{
+    xsort_u64_ws((uint64_t *)data, elements, ws);
+}
+
+static void batch_one_i64(int64_t *data, size_t elements, xsort_workspace_t *ws)
+{
+    xsort_i64_ws(data, elements, ws);
+}
+
+void xsort_u64_batch_ws(uint64_t *const arrays[], const size_t lengths[], size_t count, xsort_workspace_t *ws)
+{
+    batch_keys((int64_t *const *)arrays, lengths, count, UINT64_C(1) << 63, batch_one_u64, ws);
+}
+
+void xsort_i64_batch_ws(int64_t *const arrays[], const size_t lengths[], size_t count, xsort_workspace_t *ws)
+{
+    batch_keys(arrays, lengths, count, 0, batch_one_i64, ws);
+}
+
+// Doubles are never interleaved, for the same reason `sort_f64` avoids the
+// sorting network: it would reorder -0.0 and +0.0
+void xsort_f64_batch_ws(double *const arrays[], const size_t lengths[], size_t count, xsort_workspace_t *ws)
+{
+    batch_reserve(lengths, count, ws);
+    for (size_t i = 0; i < count; i++) {
+        xsort_f64_ws(arrays[i], lengths[i], ws);
+    }
+}
+
+void xsort_u64_batch(uint64_t *const arrays[], const size_t lengths[], size_t count)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_u64_batch_ws(arrays, lengths, count, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+void xsort_i64_batch(int64_t *const arrays[], const size_t lengths[], size_t count)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_i64_batch_ws(arrays, lengths, count, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+void xsort_f64_batch(double *const arrays[], const size_t lengths[], size_t count)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_f64_batch_ws(arrays, lengths, count, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+#pragma endregion
+
+
+#pragma region Key extraction
+
+typedef struct key_ctx_t {
+    xsort_key_fn_t key;
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} key_ctx_t;
+
+// Comparator equivalent to ordering by `sort_keyed`, for when there is no
+// room to store the keys and they must be extracted on every comparison
+static ptrdiff_t key_ctx_cmp(const void *a, const void *b, void *ptr)
+{
+    const key_ctx_t *ctx = ptr;
+    uint64_t ka = ctx->key(a, ctx->arg);
+    uint64_t kb = ctx->key(b, ctx->arg);
+    if (ka != kb) {
+        return ka < kb ? -1 : 1;
+    }
+    return ctx->cmp ? ctx->cmp(a, b, ctx->arg) : 0;
+}
+
+void xsort_by_key_ws(void *ptr, size_t elements, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    uint64_t *data = ptr;
+
+    // Pairs and their swap space take four slots per element; under
+    // `XSORT_FLAG_LOWMEM`, or without that much memory, keys are recomputed instead
+    if ((ws->flags & XSORT_FLAG_LOWMEM) || elements > SIZE_MAX / (4 * sizeof(uint64_t)) || xsort_workspace_reserve(ws, 4 * elements)) {
+        xsort_ws(ptr, elements, key_ctx_cmp, &(key_ctx_t) { .key = key, .cmp = cmp, .arg = arg }, ws);
+        return;
+    }
+
+    keyed_t *pairs = (keyed_t *)&ws->swap[0];
+    keyed_t *swap = (keyed_t *)&ws->swap[2 * elements];
+    for (size_t i = 0; i < elements; i++) {
+        pairs[i] = (keyed_t) { .key = key(&data[i], arg), .value = data[i] };
+    }
+
+    xsort_stats_attach(ws->stats);
+    sort_keyed(pairs, elements, swap, &(cmp_ctx_t) { .cmp = cmp, .arg = arg });
+    xsort_stats_attach(NULL);
+
+    for (size_t i = 0; i < elements; i++) {
+        data[i] = pairs[i].value;
+    }
+}
+
+void xsort_by_key(void *ptr, size_t elements, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg)
 {
-    void *ptr = malloc(size);
-    if (unlikely(!ptr)) {
-        abort();
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_by_key_ws(ptr, elements, key, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+}
+
+#pragma endregion
+
+
+#pragma region Argsort
+
+// Key and index sorted together, so that comparisons read the keys from
+// consecutive records instead of chasing each index. As the key comes
+// first, `sort_ctx16` hands the comparator a valid pointer to it
+typedef struct arg_rec_t {
+    uint64_t key;
+    uint64_t index;
+} arg_rec_t;
+
+typedef struct arg_ctx_t {
+    const uint64_t *keys;
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} arg_ctx_t;
+
+// Comparators for sorting bare indices when there is no room for records
+static ptrdiff_t arg_ctx_cmp64(const void *a, const void *b, void *ptr)
+{
+    const arg_ctx_t *ctx = ptr;
+    return ctx->cmp(&ctx->keys[*(const uint64_t *)a], &ctx->keys[*(const uint64_t *)b], ctx->arg);
+}
+
+static ptrdiff_t arg_ctx_cmp32(const void *a, const void *b, void *ptr)
+{
+    const arg_ctx_t *ctx = ptr;
+    return ctx->cmp(&ctx->keys[*(const uint32_t *)a], &ctx->keys[*(const uint32_t *)b], ctx->arg);
+}
+
+// Whether `elements` indices fit in `index_size` bytes each
+static bool arg_index_fits(size_t elements, size_t index_size)
+{
+    if (index_size == sizeof(uint64_t)) {
+        return true;
     }
-    return ptr;
+    return index_size == sizeof(uint32_t) && elements <= (size_t)UINT32_MAX + 1;
 }
 
-static void *xcalloc(size_t count, size_t size)
+static inline void arg_store(void *perm, size_t i, uint64_t index, size_t index_size)
 {
-    void *ptr = calloc(count, size);
-    if (unlikely(!ptr)) {
-        abort();
+    if (index_size == sizeof(uint32_t)) {
+        ((uint32_t *)perm)[i] = (uint32_t)index;
+    }
+    else {
+        ((uint64_t *)perm)[i] = index;
     }
-    return ptr;
 }
 
-static void *xrealloc(void *ptr, size_t size)
+int xargsort_ws(const void *keys, size_t elements, void *perm, size_t index_size, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
 {
-    void *ptr = realloc(ptr, size);
-    if (unlikely(!ptr)) {
-        abort();
+    if (!arg_index_fits(elements, index_size)) {
+        errno = EINVAL;
+        return -1;
     }
-    return ptr;
+    const uint64_t *src = keys;
+
+    // Records and their swap space take four slots per element
+    if (!(ws->flags & XSORT_FLAG_LOWMEM) && elements <= SIZE_MAX / (4 * sizeof(uint64_t)) && !xsort_workspace_reserve(ws, 4 * elements)) {
+        arg_rec_t *recs = (arg_rec_t *)&ws->swap[0];
+        for (size_t i = 0; i < elements; i++) {
+            recs[i] = (arg_rec_t) { .key = src[i], .index = i };
+        }
+
+        xsort_stats_attach(ws->stats);
+        sort_ctx16((elem16_t *)recs, elements, (elem16_t *)&ws->swap[2 * elements], &(cmp_ctx_t) { .cmp = cmp, .arg = arg });
+        xsort_stats_attach(NULL);
+
+        for (size_t i = 0; i < elements; i++) {
+            arg_store(perm, i, recs[i].index, index_size);
+        }
+        return 0;
+    }
+
+    // Otherwise sort the indices themselves, comparing through them
+    arg_ctx_t ctx = { .keys = src, .cmp = cmp, .arg = arg };
+    for (size_t i = 0; i < elements; i++) {
+        arg_store(perm, i, i, index_size);
+    }
+    if (index_size == sizeof(uint32_t)) {
+        return xsort_sized_ws(perm, elements, sizeof(uint32_t), arg_ctx_cmp32, &ctx, ws);
+    }
+    xsort_ws(perm, elements, arg_ctx_cmp64, &ctx, ws);
+    return 0;
+}
+
+int xargsort(const void *keys, size_t elements, void *perm, size_t index_size, cmp_ctx_fn_t cmp, void *arg)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    int status = xargsort_ws(keys, elements, perm, index_size, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+    return status;
+}
+
+int xargsort_by_key_ws(const void *keys, size_t elements, void *perm, size_t index_size, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    if (!arg_index_fits(elements, index_size)) {
+        errno = EINVAL;
+        return -1;
+    }
+    const uint64_t *src = keys;
+
+    // With 32-bit indices, prefix and index share one slot, halving the
+    // memory the merges stream through compared with records
+    if (!(ws->flags & XSORT_FLAG_LOWMEM) && elements <= (size_t)UINT32_MAX + 1 && elements <= SIZE_MAX / (2 * sizeof(uint64_t)) && !xsort_workspace_reserve(ws, 2 * elements)) {
+        uint64_t *packed = &ws->swap[0];
+        for (size_t i = 0; i < elements; i++) {
+            packed[i] = (key(&src[i], arg) & ~(uint64_t)UINT32_MAX) | i;
+        }
+
+        xsort_stats_attach(ws->stats);
+        sort_argkey(packed, elements, &ws->swap[elements], &(argkey_ctx_t) { .keys = src, .key = key, .cmp = cmp, .arg = arg });
+        xsort_stats_attach(NULL);
+
+        for (size_t i = 0; i < elements; i++) {
+            arg_store(perm, i, packed[i] & UINT32_MAX, index_size);
+        }
+        return 0;
+    }
+
+    return xargsort_ws(keys, elements, perm, index_size, key_ctx_cmp, &(key_ctx_t) { .key = key, .cmp = cmp, .arg = arg }, ws);
 }
 
-static void xfree(void *ptr)
+int xargsort_by_key(const void *keys, size_t elements, void *perm, size_t index_size, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg)
 {
-    free(ptr);
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    int status = xargsort_by_key_ws(keys, elements, perm, index_size, key, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+    return status;
 }
 
 #pragma endregion
 
 
-typedef struct segment_t {
-    size_t lh;
-    size_t q1;
-    size_t q2;
-    size_t rh;
-    size_t q3;
-    size_t q4;
-} segment_t;
+#pragma region Columns
+
+// Order-preserving key of a non-null value of `column`, reusing the radix
+// keys so that floating-point columns order like `sort_f64`
+static inline uint64_t column_key(const xsort_column_t *column, uint64_t row)
+{
+    uint64_t key = 0;
+    double f;
+    switch (column->type) {
+        case XSORT_COLUMN_U32:
+            key = ((const uint32_t *)column->data)[row];
+            break;
+        case XSORT_COLUMN_I32:
+            key = radix_key((uint64_t)(int64_t)((const int32_t *)column->data)[row], RADIX_I64);
+            break;
+        case XSORT_COLUMN_F32:
+            f = ((const float *)column->data)[row];
+            memcpy(&key, &f, sizeof(key));
+            key = radix_key(key, RADIX_F64);
+            break;
+        case XSORT_COLUMN_U64:
+            key = ((const uint64_t *)column->data)[row];
+            break;
+        case XSORT_COLUMN_I64:
+            key = radix_key(((const uint64_t *)column->data)[row], RADIX_I64);
+            break;
+        case XSORT_COLUMN_F64:
+            key = radix_key(((const uint64_t *)column->data)[row], RADIX_F64);
+            break;
+    }
+    return column->descending ? ~key : key;
+}
 
-static inline void rotate(uint64_t *restrict array, uint64_t *restrict swap, size_t left, size_t right)
+static inline bool column_null(const xsort_column_t *column, uint64_t row)
 {
-    memcpy(&swap[0], &array[0], left * sizeof(uint64_t));
-    memmove(&array[0], &array[left], right * sizeof(uint64_t));
-    memcpy(&array[right], &swap[0], left * sizeof(uint64_t));
+    return column->nulls && column->nulls[row];
 }
 
-static inline void partition_array(size_t elements, segment_t *seg)
+// Order `recs[0, n)`, whose rows tie on every column before `columns[0]`,
+// by `columns[0, count)`. The range is sorted on the first column's keys,
+// then each run of equal keys is refined on the remaining columns, so
+// later columns are only read where earlier ones tie
+static void columns_refine(keyed_t *recs, keyed_t *swap, size_t n, const xsort_column_t *columns, size_t count)
 {
-    uint64_t left = elements / 2;
-    uint64_t right = elements - left;
-    *seg = (segment_t) {
-        .lh = left,
-        .q1 = left / 2,
-        .q2 = left - (left / 2),
-        .rh = right,
-        .q3 = right / 2,
-        .q4 = right - (right / 2)
-    };
+    const xsort_column_t *column = &columns[0];
+    if (n < 2) {
+        return;
+    }
+
+    if (column->nulls) {
+        // Stable split of the nulls to the front or back, as one tied group
+        size_t valid = 0;
+        size_t nulls = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (column_null(column, recs[i].value)) {
+                swap[nulls++] = recs[i];
+            }
+            else {
+                recs[valid++] = recs[i];
+            }
+        }
+
+        // The valid rows only shift when there are nulls to go before them
+        keyed_t *group = &recs[valid];
+        if (column->nulls_first && valid && nulls) {
+            memmove(&recs[nulls], recs, valid * sizeof(keyed_t));
+            group = recs;
+        }
+        if (nulls) {
+            memcpy(group, swap, nulls * sizeof(keyed_t));
+        }
+        if (nulls > 1 && count > 1) {
+            columns_refine(group, swap, nulls, &columns[1], count - 1);
+        }
+
+        recs = column->nulls_first ? &recs[nulls] : recs;
+        n = valid;
+    }
+    if (n < 2) {
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        recs[i].key = column_key(column, recs[i].value);
+    }
+    sort_keyed(recs, n, swap, &(cmp_ctx_t) { 0 });
+
+    if (count == 1) {
+        return;
+    }
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && recs[j].key == recs[i].key) {
+            j++;
+        }
+        if (j - i > 1) {
+            columns_refine(&recs[i], swap, j - i, &columns[1], count - 1);
+        }
+        i = j;
+    }
+}
+
+typedef struct columns_ctx_t {
+    const xsort_column_t *columns;
+    size_t count;
+} columns_ctx_t;
+
+// Lexicographic comparison of two rows, for when there is no room for records
+static ptrdiff_t columns_order(const columns_ctx_t *ctx, uint64_t a, uint64_t b)
+{
+    for (size_t c = 0; c < ctx->count; c++) {
+        const xsort_column_t *column = &ctx->columns[c];
+        bool null_a = column_null(column, a);
+        bool null_b = column_null(column, b);
+        if (null_a || null_b) {
+            if (null_a == null_b) {
+                continue;
+            }
+            return null_a == column->nulls_first ? -1 : 1;
+        }
+        uint64_t ka = column_key(column, a);
+        uint64_t kb = column_key(column, b);
+        if (ka != kb) {
+            return ka < kb ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static ptrdiff_t columns_cmp64(const void *a, const void *b, void *ctx)
+{
+    return columns_order(ctx, *(const uint64_t *)a, *(const uint64_t *)b);
+}
+
+static ptrdiff_t columns_cmp32(const void *a, const void *b, void *ctx)
+{
+    return columns_order(ctx, *(const uint32_t *)a, *(const uint32_t *)b);
+}
+
+int xsort_columns_ws(const xsort_column_t *columns, size_t count, size_t rows, void *perm, size_t index_size, xsort_workspace_t *ws)
+{
+    if (!arg_index_fits(rows, index_size)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (rows < 2) {
+        if (rows) {
+            arg_store(perm, 0, 0, index_size);
+        }
+        return 0;
+    }
+
+    // Records and their swap space take four slots per row
+    if (!(ws->flags & XSORT_FLAG_LOWMEM) && rows <= SIZE_MAX / (4 * sizeof(uint64_t)) && !xsort_workspace_reserve(ws, 4 * rows)) {
+        keyed_t *recs = (keyed_t *)&ws->swap[0];
+        for (size_t i = 0; i < rows; i++) {
+            recs[i] = (keyed_t) { .value = i };
+        }
+
+        xsort_stats_attach(ws->stats);
+        if (count) {
+            columns_refine(recs, (keyed_t *)&ws->swap[2 * rows], rows, columns, count);
+        }
+        xsort_stats_attach(NULL);
+
+        for (size_t i = 0; i < rows; i++) {
+            arg_store(perm, i, recs[i].value, index_size);
+        }
+        return 0;
+    }
+
+    columns_ctx_t ctx = { .columns = columns, .count = count };
+    for (size_t i = 0; i < rows; i++) {
+        arg_store(perm, i, i, index_size);
+    }
+    if (index_size == sizeof(uint32_t)) {
+        return xsort_sized_ws(perm, rows, sizeof(uint32_t), columns_cmp32, &ctx, ws);
+    }
+    xsort_ws(perm, rows, columns_cmp64, &ctx, ws);
+    return 0;
+}
+
+int xsort_columns(const xsort_column_t *columns, size_t count, size_t rows, void *perm, size_t index_size)
+{
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    int status = xsort_columns_ws(columns, count, rows, perm, index_size, &ws);
+    xsort_workspace_destroy(&ws);
+    return status;
+}
+
+#pragma endregion
+
+
+#pragma region Selection
+
+// Ranges at or below this length are finished by insertion sort
+#define SELECT_INSERTION_MAX 16
+
+// Ranges above this length take their pivot from a ninther
+#define SELECT_NINTHER_MIN 128
+
+static inline ptrdiff_t select_cmp(const uint64_t *a, const uint64_t *b, const cmp_ctx_t *ctx)
+{
+    return ctx->cmp(a, b, ctx->arg);
+}
+
+static inline void select_xchg(uint64_t *a, uint64_t *b)
+{
+    uint64_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void select_insertion(uint64_t *data, size_t elements, const cmp_ctx_t *ctx)
+{
+    for (size_t i = 1; i < elements; i++) {
+        uint64_t x = data[i];
+        size_t j = i;
+        for (; j && select_cmp(&x, &data[j - 1], ctx) < 0; j--) {
+            data[j] = data[j - 1];
+        }
+        data[j] = x;
+    }
+}
+
+static void select_sift(uint64_t *heap, size_t root, size_t elements, const cmp_ctx_t *ctx)
+{
+    for (size_t child; (child = 2 * root + 1) < elements; root = child) {
+        if (child + 1 < elements && select_cmp(&heap[child], &heap[child + 1], ctx) < 0) {
+            child++;
+        }
+        if (select_cmp(&heap[root], &heap[child], ctx) >= 0) {
+            break;
+        }
+        select_xchg(&heap[root], &heap[child]);
+    }
+}
+
+// Worst-case fallback once partitioning stops making progress
+static void select_heapsort(uint64_t *data, size_t elements, const cmp_ctx_t *ctx)
+{
+    for (size_t i = elements / 2; i-- > 0;) {
+        select_sift(data, i, elements, ctx);
+    }
+    for (size_t end = elements; end-- > 1;) {
+        select_xchg(&data[0], &data[end]);
+        select_sift(data, 0, end, ctx);
+    }
+}
+
+static size_t select_median3(const uint64_t *data, size_t a, size_t b, size_t c, const cmp_ctx_t *ctx)
+{
+    if (select_cmp(&data[a], &data[b], ctx) < 0) {
+        if (select_cmp(&data[b], &data[c], ctx) < 0) {
+            return b;
+        }
+        return select_cmp(&data[a], &data[c], ctx) < 0 ? c : a;
+    }
+    if (select_cmp(&data[a], &data[c], ctx) < 0) {
+        return a;
+    }
+    return select_cmp(&data[b], &data[c], ctx) < 0 ? c : b;
+}
+
+static size_t select_pivot(const uint64_t *data, size_t elements, const cmp_ctx_t *ctx)
+{
+    size_t mid = elements / 2;
+    if (elements < SELECT_NINTHER_MIN) {
+        return select_median3(data, 0, mid, elements - 1, ctx);
+    }
+    size_t s = elements / 8;
+    size_t a = select_median3(data, 0, s, 2 * s, ctx);
+    size_t b = select_median3(data, mid - s, mid, mid + s, ctx);
+    size_t c = select_median3(data, elements - 1 - 2 * s, elements - 1 - s, elements - 1, ctx);
+    return select_median3(data, a, b, c, ctx);
 }
 
-// Conditionally swap `&seg[0]` and `&seg[1]` without branching
-#define xchg_ctx(seg, cmp, arg) \
-    ({ \
-        __unused uint8_t _res = cmp(&seg[0], &seg[1], arg) > 0; \
-        uint64_t _swap = seg[!_res]; \
-        seg[0] = seg[_res]; \
-        seg[1] = _swap; \
-        _res; \
-    })
-
-static void oddeven_sort_ctx(uint64_t *restrict seg, size_t elements, cmp_ctx_fn_t cmp, void *arg)
-{
-    uint64_t *pair;
-    switch (elements) {
-        default: {
-            // Alternate between even and odd iterations
-            bool z = true;
-            uint8_t itr = 1;
-            // Current element being compared, starting from the third last element
-            uint64_t *elem = &seg[elements - 3]; // 4, 5, 6, 7 => 1, 2, 3, 4,
-            do {
-                // Set pair to point to the adjacent element based on the current iteration (even or odd)
-                pair = &elem[(z = !z)];
-                do {
-                    // Compare and swap adjacent elements if necessary, update itr accordingly
-                    itr |= xchg_ctx(pair, cmp, arg);
-                    // Move to the previous pair of elements
-                    pair = &pair[-2];
-                } while (pair >= seg);
-            } while (itr-- && --elements);
+// Introselect: quickselect with three-way partitions, so runs of equal
+// elements end the search instead of degrading it, and heapsort once the
+// depth budget is spent
+static void select_nth(uint64_t *data, size_t elements, size_t nth, const cmp_ctx_t *ctx)
+{
+    size_t depth = 2 * (64 - (size_t)xsort_clz64(elements | 1));
+    while (elements > SELECT_INSERTION_MAX) {
+        if (!depth--) {
+            select_heapsort(data, elements, ctx);
             return;
         }
-        case 3:
-            // Compare and swap the first two elements if necessary
-            pair = &seg[0];
-            xchg_ctx(pair, cmp, arg);
-            // Move to the next pair of elements and compare and swap if necessary
-            pair = &pair[1];
-            if (!xchg_ctx(pair, cmp, arg)) {
-                return;
+
+        // `[0, lt)` orders before the pivot, `[lt, i)` with it and `[gt, elements)` after it
+        uint64_t pivot = data[select_pivot(data, elements, ctx)];
+        size_t lt = 0;
+        size_t i = 0;
+        size_t gt = elements;
+        while (i < gt) {
+            ptrdiff_t cmp = select_cmp(&data[i], &pivot, ctx);
+            if (cmp < 0) {
+                select_xchg(&data[lt++], &data[i++]);
             }
-            // fallthrough
-        case 2:
-            pair = &seg[0];
-            xchg_ctx(pair, cmp, arg);
-            // fallthrough
-        case 1:
-        case 0:
+            else if (cmp > 0) {
+                select_xchg(&data[i], &data[--gt]);
+            }
+            else {
+                i++;
+            }
+        }
+
+        if (nth < lt) {
+            elements = lt;
+        }
+        else if (nth >= gt) {
+            data += gt;
+            nth -= gt;
+            elements -= gt;
+        }
+        else {
             return;
+        }
     }
+    select_insertion(data, elements, ctx);
 }
 
-// Merge the two subarrays within `src` into `dst`.
-// The left subarray spans `&src[0]` to `src[left - 1]`, while the
-// right subarray spans `&src[left]` to `&src[left + right - 1]`.
-static void parity_merge_ctx(uint64_t *restrict src, uint64_t *restrict dst, size_t left, size_t right, cmp_ctx_fn_t cmp, void *arg)
+void xselect_nth(void *ptr, size_t elements, size_t nth, cmp_ctx_fn_t cmp, void *arg)
 {
-    size_t i_ptd = 0;
-    size_t i_tpd = left + right - 1;
+    if (nth < elements) {
+        select_nth(ptr, elements, nth, &(cmp_ctx_t) { .cmp = cmp, .arg = arg });
+    }
+}
 
-    size_t i_ptl = 0;
-    size_t i_ptr = left;
+void xsort_partial_ws(void *ptr, size_t elements, size_t k, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws)
+{
+    uint64_t *data = ptr;
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+    if (k >= elements) {
+        xsort_ws(ptr, elements, cmp, arg, ws);
+        return;
+    }
+    if (!k) {
+        return;
+    }
 
-    if (left < right) {
-        dst[i_ptd++] = cmp(&src[i_ptl], &src[i_ptr], arg) <= 0 ? src[i_ptl++] : src[i_ptr++];
+    // Without a full copy to select in, settle for partitioning in place
+    if ((ws->flags & XSORT_FLAG_LOWMEM) || xsort_workspace_reserve(ws, elements)) {
+        select_nth(data, elements, k - 1, &ctx);
+        xsort_ws(ptr, k, cmp, arg, ws);
+        return;
     }
 
-    size_t i_tpl = left - 1;
-    size_t i_tpr = left + right - 1;
+    // Find the k-th smallest element in a copy, leaving `data` in its
+    // original order
+    uint64_t *swap = ws->swap;
+    memcpy(swap, data, elements * sizeof(uint64_t));
+    select_nth(swap, elements, k - 1, &ctx);
+    uint64_t pivot = swap[k - 1];
 
-    while (--left) {
-        dst[i_ptd++] = cmp(&src[i_ptl], &src[i_ptr], arg) <= 0 ? src[i_ptl++] : src[i_ptr++];
-        dst[i_tpd--] = cmp(&src[i_tpl], &src[i_tpr], arg) > 0 ? src[i_tpl--] : src[i_tpr--];
+    // Stable split around it: smaller elements are compacted in place,
+    // equal ones collected from the front of `swap` and larger ones from
+    // its back. The prefix then holds exactly the elements a full stable
+    // sort would put there, in their original order
+    size_t lt = 0;
+    size_t eq = 0;
+    size_t gt = elements;
+    for (size_t i = 0; i < elements; i++) {
+        uint64_t x = data[i];
+        ptrdiff_t order = select_cmp(&x, &pivot, &ctx);
+        if (order < 0) {
+            data[lt++] = x;
+        }
+        else if (!order) {
+            swap[eq++] = x;
+        }
+        else {
+            swap[--gt] = x;
+        }
     }
+    memcpy(&data[lt], swap, eq * sizeof(uint64_t));
+    memcpy(&data[lt + eq], &swap[gt], (elements - gt) * sizeof(uint64_t));
 
-    dst[i_tpd] = cmp(&src[i_tpl], &src[i_tpr], arg) > 0 ? src[i_tpl] : src[i_tpr];
-    dst[i_ptd] = cmp(&src[i_ptl], &src[i_ptr], arg) <= 0 ? src[i_ptl] : src[i_ptr];
+    xsort_ws(ptr, k, cmp, arg, ws);
 }
 
-void xsort(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg)
+void xsort_partial(void *ptr, size_t elements, size_t k, cmp_ctx_fn_t cmp, void *arg)
 {
-    typedef struct stack_frame_t {
-        uint64_t *data;
-        size_t elements;
-        segment_t segment;
-        void *ret_addr;
-    } stack_frame_t;
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_partial_ws(ptr, elements, k, cmp, arg, &ws);
+    xsort_workspace_destroy(&ws);
+}
 
-    uint64_t *data = ptr;
+#pragma endregion
+
+
+#pragma region Incremental
+
+// Pending appends are sorted into a run once at least this many accumulate
+#define CTX_BATCH 1024
+
+void xsort_ctx_init(xsort_ctx_t *ctx, cmp_ctx_fn_t cmp, void *arg)
+{
+    *ctx = (xsort_ctx_t) { .cmp = cmp, .arg = arg };
+    xsort_workspace_init(&ctx->ws);
+}
+
+void xsort_ctx_destroy(xsort_ctx_t *ctx)
+{
+    xfree(ctx->ws.allocator, ctx->data);
+    xsort_workspace_destroy(&ctx->ws);
+    ctx->data = NULL;
+    ctx->elements = 0;
+    ctx->capacity = 0;
+    ctx->sorted = 0;
+    ctx->run_count = 0;
+}
+
+// Merge the two newest runs, galloping through a copy of the older one
+// when the workspace can hold it and in place otherwise
+static void ctx_merge_top(xsort_ctx_t *ctx)
+{
+    size_t right = ctx->runs[--ctx->run_count];
+    size_t left = ctx->runs[ctx->run_count - 1];
+    uint64_t *data = &ctx->data[ctx->sorted - left - right];
+    cmp_ctx_t cmp = { .cmp = ctx->cmp, .arg = ctx->arg };
+
+    uint64_t fallback[LOWMEM_STACK_SLOTS];
+    void *swap;
+    size_t cap = acquire_scratch(&ctx->ws, data, left, sizeof(uint64_t), fallback, &swap);
+
+    xsort_stats_attach(ctx->ws.stats);
+    if (cap == left) {
+        sort_ctx_gallop_merge_adjacent(data, left, right, swap, &cmp);
+    }
+    else {
+        sort_ctx_gallop_merge_inplace(data, left, right, swap, cap, &cmp);
+    }
+    xsort_stats_attach(NULL);
+
+    ctx->runs[ctx->run_count - 1] = left + right;
+}
+
+// Turn the pending appends into the newest run, then merge until every
+// run is more than twice as long as the next
+static void ctx_push_pending(xsort_ctx_t *ctx)
+{
+    size_t pending = ctx->elements - ctx->sorted;
+    if (!pending) {
+        return;
+    }
 
-    uint64_t *swap = xmalloc(elements * sizeof(uint64_t));
+    xsort_ws(&ctx->data[ctx->sorted], pending, ctx->cmp, ctx->arg, &ctx->ws);
+    ctx->runs[ctx->run_count++] = pending;
+    ctx->sorted = ctx->elements;
+
+    while (ctx->run_count > 1 && ctx->runs[ctx->run_count - 2] <= 2 * ctx->runs[ctx->run_count - 1]) {
+        ctx_merge_top(ctx);
+    }
+}
+
+int xsort_ctx_append(xsort_ctx_t *ctx, const void *elems, size_t count)
+{
+    if (unlikely(count > SIZE_MAX / sizeof(uint64_t) - ctx->elements)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t needed = ctx->elements + count;
+    if (needed > ctx->capacity) {
+        size_t capacity = ctx->capacity < CTX_BATCH ? CTX_BATCH : ctx->capacity;
+        while (capacity < needed) {
+            capacity = capacity > SIZE_MAX / (2 * sizeof(uint64_t)) ? needed : 2 * capacity;
+        }
+        uint64_t *data = xmalloc(ctx->ws.allocator, capacity * sizeof(uint64_t));
+        if (unlikely(!data)) {
+            return -1;
+        }
+        if (ctx->elements) {
+            memcpy(data, ctx->data, ctx->elements * sizeof(uint64_t));
+        }
+        xfree(ctx->ws.allocator, ctx->data);
+        ctx->data = data;
+        ctx->capacity = capacity;
+    }
+
+    if (count) {
+        memcpy(&ctx->data[ctx->elements], elems, count * sizeof(uint64_t));
+        ctx->elements = needed;
+    }
+    if (ctx->elements - ctx->sorted >= CTX_BATCH) {
+        ctx_push_pending(ctx);
+    }
+    return 0;
+}
+
+void xsort_ctx_flush(xsort_ctx_t *ctx)
+{
+    ctx_push_pending(ctx);
+    while (ctx->run_count > 1) {
+        ctx_merge_top(ctx);
+    }
+}
+
+const void *xsort_ctx_view(xsort_ctx_t *ctx, size_t *elements)
+{
+    xsort_ctx_flush(ctx);
+    *elements = ctx->elements;
+    return ctx->data;
+}
+
+#pragma endregion
 
-    ptrdiff_t stack_depth = 0;
-    ptrdiff_t frame_capacity = 128;
 
-    stack_frame_t *stk = xmalloc(frame_capacity * sizeof(stack_frame_t));
+#pragma region Resumable
 
-    stk[stack_depth] = (stack_frame_t) {
-        .data = data,
+typedef enum job_state_t {
+    JOB_BLOCKS,
+    JOB_MERGE,
+    JOB_COPY,
+    JOB_DONE,
+    JOB_CANCELLED,
+} job_state_t;
+
+int xsort_job_init(xsort_job_t *job, void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg)
+{
+    *job = (xsort_job_t) {
+        .data = ptr,
         .elements = elements,
-        .segment = { 0 },
-        .ret_addr = &&ret_addr_0,
+        .cmp = cmp,
+        .arg = arg,
+        .state = elements > 1 ? JOB_BLOCKS : JOB_DONE,
+        .width = XSORT_STEP_BLOCK,
     };
+    xsort_workspace_init(&job->ws);
+    if (elements > 1 && xsort_workspace_reserve(&job->ws, elements)) {
+        return -1;
+    }
 
-    while (stack_depth >= 0) {
-        if (unlikely(stack_depth + 2 >= frame_capacity)) {
-            frame_capacity *= 2;
-            stk = xrealloc(stk, frame_capacity * sizeof(stack_frame_t));
-            fprintf(stderr, "[warning] resizing %s stack for %" PRIiPTR " frames\n", __FUNCTION__, frame_capacity);
-        }
+    // Every pass moves each element once, as does sorting the blocks and
+    // copying back a result that ends up in the workspace
+    size_t passes = 0;
+    for (size_t width = XSORT_STEP_BLOCK; width < elements; width = width > elements / 2 ? elements : 2 * width) {
+        passes++;
+    }
+    job->total = elements > 1 ? elements * (1 + passes + (passes & 1)) : 0;
+    return 0;
+}
+
+void xsort_job_destroy(xsort_job_t *job)
+{
+    xsort_workspace_destroy(&job->ws);
+}
 
-        stack_frame_t stk_top = stk[stack_depth--];
-        data = stk_top.data;
-        elements = stk_top.elements;
-        segment_t segment = stk_top.segment;
-        goto *stk_top.ret_addr;
+// Bounds of the pair of runs the merge pass is working through, and the
+// number of elements of the left run among its first `rank` outputs
+static size_t job_split(const xsort_job_t *job, const uint64_t *src, size_t rank, size_t *mid, size_t *hi, cmp_ctx_t *ctx)
+{
+    size_t n = job->elements;
+    size_t lo = job->base;
+    *mid = n - lo > job->width ? lo + job->width : n;
+    *hi = n - *mid > job->width ? *mid + job->width : n;
+    return sort_ctx_corank(rank, &src[lo], *mid - lo, &src[*mid], *hi - *mid, ctx);
+}
 
-ret_addr_0:
-        if (elements <= 7) {
-            oddeven_sort_ctx(data, elements, cmp, arg);
-            continue;
-        }
+// Produce up to `XSORT_STEP_BLOCK` more outputs of the current merge,
+// moving on to the next pair or pass once it is complete. Returns the
+// number of elements moved
+static size_t job_merge(xsort_job_t *job, cmp_ctx_t *ctx)
+{
+    uint64_t *src = job->in_swap ? job->ws.swap : job->data;
+    uint64_t *dst = job->in_swap ? job->data : job->ws.swap;
+    size_t lo = job->base;
+    size_t mid;
+    size_t hi;
+    size_t i = job_split(job, src, job->merged, &mid, &hi, ctx);
+    size_t count = hi - lo - job->merged < XSORT_STEP_BLOCK ? hi - lo - job->merged : XSORT_STEP_BLOCK;
+    size_t end = job_split(job, src, job->merged + count, &mid, &hi, ctx);
 
-        partition_array(elements, &segment);
+    size_t j = job->merged - i;
+    sort_ctx_merge(&src[lo + i], end - i, &src[mid + j], job->merged + count - end - j, &dst[lo + job->merged], ctx);
+    job->merged += count;
 
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[0],
-            .elements = elements,
-            .segment = segment,
-            .ret_addr = &&ret_addr_1
-        };
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[0],
-            .elements = segment.q1,
-            .segment = segment,
-            .ret_addr = &&ret_addr_0
-        };
-        continue;
-ret_addr_1:
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[0],
-            .elements = elements,
-            .segment = segment,
-            .ret_addr = &&ret_addr_2
-        };
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[segment.q1],
-            .elements = segment.q2,
-            .segment = segment,
-            .ret_addr = &&ret_addr_0
-        };
-        continue;
-ret_addr_2:
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[0],
-            .elements = elements,
-            .segment = segment,
-            .ret_addr = &&ret_addr_3
-        };
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[segment.lh],
-            .elements = segment.q3,
-            .segment = segment,
-            .ret_addr = &&ret_addr_0
-        };
-        continue;
-ret_addr_3:
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[0],
-            .elements = elements,
-            .segment = segment,
-            .ret_addr = &&ret_addr_4
-        };
-        stk[++stack_depth] = (stack_frame_t) {
-            .data = &data[segment.lh + segment.q3],
-            .elements = segment.q4,
-            .segment = segment,
-            .ret_addr = &&ret_addr_0
-        };
-        continue;
-ret_addr_4:
-        if (cmp(&data[segment.q1 - 1], &data[segment.q1], arg) <= 0) {
-            if (cmp(&data[segment.lh - 1], &data[segment.lh], arg) <= 0) {
-                if (cmp(&data[segment.lh + segment.q3 - 1], &data[segment.lh + segment.q3], arg) <= 0) {
-                    continue;
-                }
+    if (lo + job->merged == hi) {
+        job->base = hi;
+        job->merged = 0;
+        if (hi == job->elements) {
+            job->base = 0;
+            job->in_swap = !job->in_swap;
+            job->width = job->width > job->elements / 2 ? job->elements : 2 * job->width;
+            if (job->width >= job->elements) {
+                job->state = job->in_swap ? JOB_COPY : JOB_DONE;
             }
         }
+    }
+    return count;
+}
+
+// Put every element back into `data` after a cancellation. Passes that
+// read from `data` have not overwritten any of it; passes that read from
+// the workspace have merged a prefix of it back, and the rest is copied
+static void job_restore(xsort_job_t *job, cmp_ctx_t *ctx)
+{
+    size_t n = job->elements;
+    const uint64_t *src = job->ws.swap;
+    if (job->state == JOB_MERGE && job->in_swap) {
+        size_t lo = job->base;
+        size_t mid;
+        size_t hi;
+        size_t i = job_split(job, src, job->merged, &mid, &hi, ctx);
+        size_t j = job->merged - i;
+        uint64_t *out = &job->data[lo + job->merged];
+        memcpy(out, &src[lo + i], (mid - lo - i) * sizeof(uint64_t));
+        memcpy(&out[mid - lo - i], &src[mid + j], (hi - mid - j) * sizeof(uint64_t));
+        memcpy(&job->data[hi], &src[hi], (n - hi) * sizeof(uint64_t));
+    }
+    else if (job->state == JOB_COPY) {
+        memcpy(&job->data[job->base], &src[job->base], (n - job->base) * sizeof(uint64_t));
+    }
+}
+
+int xsort_step(xsort_job_t *job, size_t budget)
+{
+    cmp_ctx_t ctx = { .cmp = job->cmp, .arg = job->arg };
+    size_t n = job->elements;
+
+    xsort_stats_attach(job->ws.stats);
+    size_t spent = 0;
+    do {
+        if (job->state == JOB_DONE || job->state == JOB_CANCELLED) {
+            break;
+        }
+        if (job->cancel && job->cancel(job->user)) {
+            job_restore(job, &ctx);
+            job->state = JOB_CANCELLED;
+            break;
+        }
 
-        if (cmp(&data[0], &data[segment.lh - 1], arg) > 0) {
-            if (cmp(&data[segment.q1], &data[segment.lh + segment.q3 - 1], arg) > 0) {
-                if (cmp(&data[segment.lh], &data[elements - 1], arg) > 0) {
-                    rotate(&data[0], &swap[0], segment.q1, segment.q2 + segment.rh);
-                    rotate(&data[0], &swap[0], segment.q2, segment.rh);
-                    rotate(&data[0], &swap[0], segment.q3, segment.q4);
-                    continue;
+        size_t moved;
+        switch (job->state) {
+            case JOB_BLOCKS:
+                moved = n - job->base < XSORT_STEP_BLOCK ? n - job->base : XSORT_STEP_BLOCK;
+                sort_ctx(&job->data[job->base], moved, job->ws.swap, &ctx);
+                job->base += moved;
+                if (job->base == n) {
+                    job->base = 0;
+                    job->state = job->width < n ? JOB_MERGE : JOB_DONE;
                 }
-            }
+                break;
+            case JOB_MERGE:
+                moved = job_merge(job, &ctx);
+                break;
+            default:
+                moved = n - job->base < XSORT_STEP_BLOCK ? n - job->base : XSORT_STEP_BLOCK;
+                memcpy(&job->data[job->base], &job->ws.swap[job->base], moved * sizeof(uint64_t));
+                job->base += moved;
+                if (job->base == n) {
+                    job->state = JOB_DONE;
+                }
+                break;
         }
+        job->done += moved;
+        spent += moved;
+    } while (spent < budget);
+    xsort_stats_attach(NULL);
 
-        parity_merge_ctx(&data[0], &swap[0], segment.q1, segment.q2, cmp, arg);
-        parity_merge_ctx(&data[segment.lh], &swap[segment.lh], segment.q3, segment.q4, cmp, arg);
-        parity_merge_ctx(&swap[0], &data[0], segment.lh, segment.rh, cmp, arg);
+    if (job->progress) {
+        job->progress(job->done, job->total, job->user);
+    }
+    if (job->state == JOB_CANCELLED) {
+        errno = ECANCELED;
+        return -1;
     }
-    xfree(swap);
-    xfree(stk);
+    return job->state != JOB_DONE;
 }
+
+#pragma endregion
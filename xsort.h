@@ -21,18 +21,18 @@
 
 
 #ifndef __has_builtin
-    #define __has_builtin(x)
+    #define __has_builtin(x) 0
 #endif
 
 #ifndef __has_attribute
-    #define __has_attribute(x)
+    #define __has_attribute(x) 0
 #endif
 
 #ifndef unlikely
     #if __has_builtin(__builtin_expect)
         #define unlikely(x) __builtin_expect(!!(x), 0)
     #else
-        #define unlikely(x)
+        #define unlikely(x) (x)
     #endif
 #endif
 
@@ -40,7 +40,7 @@
     #if __has_builtin(__builtin_expect)
         #define likely(x) __builtin_expect(!!(x), 1)
     #else
-        #define likely(x)
+        #define likely(x) (x)
     #endif
 #endif
 
@@ -52,9 +52,377 @@
     #endif
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef ptrdiff_t (*cmp_ctx_fn_t)(const void *, const void *, void *);
 
 // Sort array of 64-bit elements.
 // Supports context-aware comparison via a user-provided
-// comparison function `cmp` and an auxiliary argument `arg`
+// comparison function `cmp` and an auxiliary argument `arg`.
+//
+// Every sort and merge in this library is stable: elements that compare
+// equal keep their original relative order, whatever the input, flags,
+// thread count or memory available. No tie-breaking pass on the original
+// index is needed
 void xsort(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg);
+
+// Behaviour toggles honoured by `xsort_ws()` and the other `_ws` variants
+typedef enum xsort_flags_t {
+    // Merge with exponential searches once one run keeps winning, trading
+    // extra element moves for far fewer comparisons on skewed input.
+    // Worthwhile when the comparator is expensive. Used by `xsort_ws()` only
+    XSORT_FLAG_GALLOP = 1 << 0,
+    // Bound scratch memory by about the square root of the element count
+    // (never under 512 elements) instead of a full copy of the array, at the
+    // cost of in-place merges that move data more. Records whose width is
+    // not 4, 8, 16 or 32 bytes still need two references per element
+    XSORT_FLAG_LOWMEM = 1 << 1,
+    // Sort inputs far larger than L2 as L2-sized blocks, then merge the
+    // blocks many at a time through a loser tree, which passes over the
+    // array about log2(fan-in) times less often. A loser tree pass takes
+    // longer than the pairwise passes it replaces, so this only pays where
+    // memory bandwidth rather than computation bounds the sort, such as
+    // many threads sharing a small last-level cache.
+    // Used by `xsort_ws()` only, and ignored under `XSORT_FLAG_LOWMEM`
+    XSORT_FLAG_BLOCKED = 1 << 2,
+    // Map scratch buffers of 32 MiB or more directly, backed by huge pages
+    // where the system provides them, and on Linux place them on the same
+    // NUMA node as the array being sorted. Cuts the TLB misses and remote
+    // memory traffic of multi-gigabyte sorts. Ignored when the workspace
+    // has an `allocator`
+    XSORT_FLAG_HUGEPAGES = 1 << 3,
+} xsort_flags_t;
+
+// Source of workspace memory, such as a per-request arena. `alloc` returns
+// NULL on failure, and `release` only ever receives pointers from `alloc`
+typedef struct xsort_allocator_t {
+    void *(*alloc)(size_t size, void *ctx);
+    void (*release)(void *ptr, void *ctx);
+    void *ctx;
+} xsort_allocator_t;
+
+// Stages of the engine that `xsort_stats_t` breaks its figures down by
+typedef enum xsort_phase_t {
+    // Sorting networks and vector kernels on the smallest segments
+    XSORT_PHASE_LEAF,
+    // Checks for quarters that are already in order or fully reversed
+    XSORT_PHASE_PRESORT,
+    // Scanning for natural runs
+    XSORT_PHASE_RUNS,
+    // Merging, including the searches of galloping and in-place merges
+    XSORT_PHASE_MERGE,
+    XSORT_PHASE_COUNT,
+} xsort_phase_t;
+
+// Counters accumulated by the `_ws` sorts into `xsort_workspace_t.stats`
+// when the library is built with `XSORT_STATS`, and left untouched
+// otherwise. Only work done on the calling thread is counted, so the
+// sorts and merges of `xsort_parallel()` and `xmerge_parallel()`, which
+// take no workspace, report nothing. `cycles` also requires `XSORT_STATS_CYCLES` and is measured in
+// the platform's counter ticks (TSC cycles on x86). Comparisons made inside
+// the vector kernels of the key-only sorts are not included in `compares`;
+// segments handed to them are counted in `leaf_kernels`
+typedef struct xsort_stats_t {
+    uint64_t compares[XSORT_PHASE_COUNT];
+    uint64_t cycles[XSORT_PHASE_COUNT];
+    uint64_t leaf_kernels;
+    // Segments whose sorted quarters were found to be in order already
+    uint64_t sorted_skips;
+    // Segments whose quarters were strictly descending and simply rotated
+    uint64_t reverse_rotations;
+    // Sorts handled by merging the input's natural runs
+    uint64_t natural_sorts;
+    // Bytes moved by block rotations
+    uint64_t moved_bytes;
+} xsort_stats_t;
+
+// Reusable scratch memory for `xsort_ws()`. Once reserved for a given
+// number of elements, sorts of that size or smaller perform no allocation
+typedef struct xsort_workspace_t {
+    uint64_t *swap;
+    size_t swap_capacity;
+    // Length of the mapping behind `swap` when `XSORT_FLAG_HUGEPAGES`
+    // provided it, zero when it came from the allocator
+    size_t swap_mapped;
+    // Bitwise OR of `xsort_flags_t`, zero by default
+    unsigned flags;
+    // Memory comes from `malloc()` while this is NULL. Set it after
+    // `xsort_workspace_init()`; it must outlive the workspace
+    const xsort_allocator_t *allocator;
+    // Accumulates instrumentation when non-NULL; see `xsort_stats_t`
+    xsort_stats_t *stats;
+} xsort_workspace_t;
+
+void xsort_workspace_init(xsort_workspace_t *ws);
+// Grow the workspace to accommodate sorting `elements` 64-bit elements.
+// Returns 0 on success, or -1 with `errno` set to `ENOMEM`, in which case
+// the workspace keeps its previous buffer
+int xsort_workspace_reserve(xsort_workspace_t *ws, size_t elements);
+void xsort_workspace_destroy(xsort_workspace_t *ws);
+
+// Cache line size assumed when sizing the engine's multi-way merges
+#define XSORT_CACHE_LINE 64
+
+// Per-core data cache sizes, in bytes, that `XSORT_FLAG_BLOCKED` schedules
+// large sorts around: blocks are sized to L2 and merge fan-in to L1. They
+// are detected on first use, falling back to 32 KiB and 1 MiB when the
+// system does not report them
+typedef struct xsort_cache_t {
+    size_t l1;
+    size_t l2;
+} xsort_cache_t;
+
+const xsort_cache_t *xsort_cache(void);
+
+// Override the detected sizes for all subsequent sorts, for instance when
+// a core's share of a cache is smaller than the whole. An `l2` of zero
+// disables blocking altogether. Not safe to call while sorts are running
+void xsort_set_cache(const xsort_cache_t *cache);
+
+// Same as `xsort()`, but draws scratch memory from `ws` instead of
+// allocating and releasing it on every call.
+//
+// None of the sorts fail for lack of memory: when scratch space cannot be
+// reserved they fall back to the `XSORT_FLAG_LOWMEM` merges, using a small
+// on-stack buffer if even the low-memory reservation fails
+void xsort_ws(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+// Sort array of `size`-byte elements in place, with the same comparator
+// convention as `xsort()`. Widths of 4, 8, 16 and 32 bytes are moved
+// directly; other widths are ordered through an array of references
+// before each record is moved once into its final position. Returns 0 on
+// success, or -1 with `errno` set to `ENOMEM` if the references for other
+// widths cannot be allocated, leaving the array untouched
+int xsort_sized(void *ptr, size_t elements, size_t size, cmp_ctx_fn_t cmp, void *arg);
+int xsort_sized_ws(void *ptr, size_t elements, size_t size, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+// Sort arrays of unsigned, signed, or floating-point 64-bit values in
+// ascending order without a comparison callback. `xsort_f64()` orders
+// NaNs after all other values, and treats -0.0 and +0.0 as equal, keeping
+// each group of them in its original order. Large inputs that are not
+// already nearly sorted are radix sorted in the workspace's swap buffer,
+// which then also holds the digit histograms; under `XSORT_FLAG_LOWMEM`,
+// or when that buffer cannot be reserved, they are merged instead
+void xsort_u64(uint64_t *ptr, size_t elements);
+void xsort_i64(int64_t *ptr, size_t elements);
+void xsort_f64(double *ptr, size_t elements);
+
+void xsort_u64_ws(uint64_t *ptr, size_t elements, xsort_workspace_t *ws);
+void xsort_i64_ws(int64_t *ptr, size_t elements, xsort_workspace_t *ws);
+void xsort_f64_ws(double *ptr, size_t elements, xsort_workspace_t *ws);
+
+// Sort each of the `count` arrays `arrays[i][0, lengths[i])` of 64-bit
+// elements independently, as `xsort()` would, sharing one workspace
+// between them. Meant for many small arrays, where setting up a sort
+// for each one would dominate
+void xsort_batch(void *const arrays[], const size_t lengths[], size_t count, cmp_ctx_fn_t cmp, void *arg);
+void xsort_batch_ws(void *const arrays[], const size_t lengths[], size_t count, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+// Key-only counterparts of `xsort_batch()`. Integer arrays short enough
+// for the processor's vector registers are sorted several at a time, one
+// per lane, by a single sorting network
+void xsort_u64_batch(uint64_t *const arrays[], const size_t lengths[], size_t count);
+void xsort_i64_batch(int64_t *const arrays[], const size_t lengths[], size_t count);
+void xsort_f64_batch(double *const arrays[], const size_t lengths[], size_t count);
+
+void xsort_u64_batch_ws(uint64_t *const arrays[], const size_t lengths[], size_t count, xsort_workspace_t *ws);
+void xsort_i64_batch_ws(int64_t *const arrays[], const size_t lengths[], size_t count, xsort_workspace_t *ws);
+void xsort_f64_batch_ws(double *const arrays[], const size_t lengths[], size_t count, xsort_workspace_t *ws);
+
+// Order-preserving key of `*elem`: an element with a smaller key must
+// also order first under the accompanying comparator
+typedef uint64_t (*xsort_key_fn_t)(const void *elem, void *arg);
+
+// Sort array of 64-bit elements by `key`, extracted once per element, calling
+// `cmp` only to order elements whose keys are equal. With `cmp` NULL such
+// elements keep their original order. Worthwhile when the comparator is far
+// more expensive than the key, e.g. a key prefix of a collated string.
+// Uses four 64-bit slots of scratch per element
+void xsort_by_key(void *ptr, size_t elements, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg);
+void xsort_by_key_ws(void *ptr, size_t elements, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+// Store in `perm` the permutation that sorts the 64-bit elements `keys`:
+// `keys[perm[0]]` orders first, and so on, with equal elements in index
+// order. Indices are `index_size` bytes wide, either 4 or 8; `keys` is
+// left untouched. Each key is sorted alongside its index, so comparisons
+// read consecutive memory, using four 64-bit slots of scratch per element.
+// Returns 0 on success, or -1 with `errno` set to `EINVAL` if `index_size`
+// is unsupported or too narrow to index every element
+int xargsort(const void *keys, size_t elements, void *perm, size_t index_size, cmp_ctx_fn_t cmp, void *arg);
+int xargsort_ws(const void *keys, size_t elements, void *perm, size_t index_size, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+// As `xargsort()`, ordering by `key` as `xsort_by_key()` does. Up to 2^32
+// elements are sorted as the high half of their key packed above a 32-bit
+// index in a single slot, using two slots of scratch per element
+int xargsort_by_key(const void *keys, size_t elements, void *perm, size_t index_size, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg);
+int xargsort_by_key_ws(const void *keys, size_t elements, void *perm, size_t index_size, xsort_key_fn_t key, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+typedef enum xsort_column_type_t {
+    XSORT_COLUMN_U32,
+    XSORT_COLUMN_I32,
+    XSORT_COLUMN_F32,
+    XSORT_COLUMN_U64,
+    XSORT_COLUMN_I64,
+    XSORT_COLUMN_F64,
+} xsort_column_type_t;
+
+// One sort key of a table stored as separate column arrays. Floating-point
+// columns order like `xsort_f64()`, and descending columns in exactly the
+// reverse order
+typedef struct xsort_column_t {
+    // One value of `type` per row
+    const void *data;
+    xsort_column_type_t type;
+    bool descending;
+    // Nonzero for each null row, or NULL if the column has none. Nulls
+    // compare equal to one another, and go before or after every value
+    // regardless of `descending`
+    const uint8_t *nulls;
+    bool nulls_first;
+} xsort_column_t;
+
+// Store in `perm` the permutation ordering `rows` rows by `columns[0]`,
+// then `columns[1]` among rows tied on it, and so on, with fully tied rows
+// in index order. Indices are `index_size` bytes, as for `xargsort()`.
+// Columns are applied one at a time, and a column is only read for rows
+// still tied on every column before it. Uses four 64-bit slots of scratch
+// per row; under `XSORT_FLAG_LOWMEM`, or without that much memory, rows
+// are compared column by column instead. Returns 0 on success, or -1 with
+// `errno` set to `EINVAL` if `index_size` cannot index every row
+int xsort_columns(const xsort_column_t *columns, size_t count, size_t rows, void *perm, size_t index_size);
+int xsort_columns_ws(const xsort_column_t *columns, size_t count, size_t rows, void *perm, size_t index_size, xsort_workspace_t *ws);
+
+// Reorder array of 64-bit elements so that the first `k` hold, in sorted
+// order, the `k` smallest, leaving the rest in unspecified order. Selection
+// runs in a copy of the array followed by a stable split, so the prefix
+// matches the first `k` elements `xsort()` would produce, ties included.
+// Under `XSORT_FLAG_LOWMEM`, or without room for the copy, the array is
+// partitioned in place instead and which of the elements equal to the
+// k-th smallest make the prefix is unspecified
+void xsort_partial(void *ptr, size_t elements, size_t k, cmp_ctx_fn_t cmp, void *arg);
+void xsort_partial_ws(void *ptr, size_t elements, size_t k, cmp_ctx_fn_t cmp, void *arg, xsort_workspace_t *ws);
+
+// Reorder array of 64-bit elements in place, without allocating, so that
+// `ptr[nth]` holds the element sorted order places there, with nothing
+// before it ordering after it and nothing after it ordering before it.
+// Expected linear time. Not stable; does nothing if `nth` is out of range
+void xselect_nth(void *ptr, size_t elements, size_t nth, cmp_ctx_fn_t cmp, void *arg);
+
+// Runs an `xsort_ctx_t` can hold. Each run is more than twice as long as
+// the next, so a 64-bit size never needs more
+#define XSORT_CTX_RUNS 64
+
+// Sorted collection of 64-bit elements that grows by appending. Appends
+// are buffered and sorted a batch at a time into runs, which are merged
+// as they pile up so that each element takes part in O(log n) merges
+typedef struct xsort_ctx_t {
+    // Runs back to back, oldest first, followed by pending appends
+    uint64_t *data;
+    size_t elements;
+    size_t capacity;
+    // Elements covered by `runs`
+    size_t sorted;
+    size_t runs[XSORT_CTX_RUNS];
+    size_t run_count;
+    cmp_ctx_fn_t cmp;
+    void *arg;
+    // Scratch for sorting and merging. Its allocator also provides `data`
+    xsort_workspace_t ws;
+} xsort_ctx_t;
+
+void xsort_ctx_init(xsort_ctx_t *ctx, cmp_ctx_fn_t cmp, void *arg);
+void xsort_ctx_destroy(xsort_ctx_t *ctx);
+
+// Copy `count` elements into the collection. Returns 0 on success, or -1
+// with `errno` set to `ENOMEM`, leaving the collection unchanged
+int xsort_ctx_append(xsort_ctx_t *ctx, const void *elems, size_t count);
+
+// Sort pending appends and merge every run into one
+void xsort_ctx_flush(xsort_ctx_t *ctx);
+
+// Flush, then return the collection in `xsort()` order with equal elements
+// in the order they were appended, storing its length in `*elements`. The
+// view is invalidated by the next append
+const void *xsort_ctx_view(xsort_ctx_t *ctx, size_t *elements);
+
+// Work `xsort_step()` does as one indivisible unit, in elements
+#define XSORT_STEP_BLOCK 4096
+
+// Sort of an array of 64-bit elements carried out a bounded amount of work
+// at a time, for callers that interleave it with other work or must be
+// able to abandon it. Blocks of `XSORT_STEP_BLOCK` elements are sorted
+// first, then merged pairwise a pass at a time, with every merge resumable
+// at any output position. The ordering is that of `xsort()`
+typedef struct xsort_job_t {
+    uint64_t *data;
+    size_t elements;
+    cmp_ctx_fn_t cmp;
+    void *arg;
+    // Optional. Polled before each unit of work; returning true stops the
+    // sort, leaving `data` a permutation of its original contents
+    bool (*cancel)(void *user);
+    // Optional. Called at the end of every step with the elements moved so
+    // far and the total the sort will move
+    void (*progress)(size_t done, size_t total, void *user);
+    void *user;
+    size_t done;
+    size_t total;
+    // Current phase, and the pass and merge within it
+    int state;
+    size_t width;
+    size_t base;
+    size_t merged;
+    bool in_swap;
+    xsort_workspace_t ws;
+} xsort_job_t;
+
+// Prepare to sort `ptr` in steps. Returns 0 on success, or -1 with `errno`
+// set to `ENOMEM` if the job's copy of the array cannot be reserved
+int xsort_job_init(xsort_job_t *job, void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg);
+void xsort_job_destroy(xsort_job_t *job);
+
+// Advance the sort by about `budget` elements' worth of work, and at least
+// one unit. Returns 1 while work remains, 0 once `data` is sorted, or -1
+// with `errno` set to `ECANCELED` once `cancel` has stopped the sort
+int xsort_step(xsort_job_t *job, size_t budget);
+
+// Sort array of 64-bit elements using up to `nthreads` threads, or one per
+// online processor if `nthreads` is zero. Produces the same ordering as `xsort()`
+void xsort_parallel(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg, size_t nthreads);
+
+// Merge the sorted runs `src[0, left)` and `src[left, left + right)` of 64-bit
+// elements into `dst` using up to `nthreads` threads, taking from the left
+// run on ties. `dst` must not overlap `src`
+void xmerge_parallel(const void *src, size_t left, size_t right, void *dst, cmp_ctx_fn_t cmp, void *arg, size_t nthreads);
+
+// Merge the `k` sorted runs `runs[i][0, lengths[i])` of 64-bit elements into
+// `dst` with a loser tree, at about log2(k) comparisons per element. Equal
+// elements keep the order of their runs. `dst` must not overlap any run.
+// Returns 0 on success, or -1 with `errno` set to `ENOMEM`
+int xmerge_k(const void *const runs[], const size_t lengths[], size_t k, void *dst, cmp_ctx_fn_t cmp, void *arg);
+
+// Sort a stream of 64-bit elements read from `in_fd` until end of file,
+// writing the result to `out_fd`, with the same ordering as `xsort()`.
+// Chunks of roughly `memory_budget` bytes are sorted in memory and spilled
+// as runs to `$TMPDIR` for a k-way merge, so the input may be far larger
+// than memory. Returns 0 on success, or -1 with `errno` set on I/O failure
+int xsort_external(int in_fd, int out_fd, size_t memory_budget, cmp_ctx_fn_t cmp, void *arg);
+
+// Sort the file at `path`, made up of `record_size`-byte records, in place
+// with the same ordering as `xsort_sized()`. When the records and the
+// scratch space for them fit in `memory_budget` bytes (half of physical
+// memory if zero), the file is mapped and sorted through the mapping,
+// without copying it into the heap. Larger files, and those whose scratch
+// space cannot be allocated, go through the pipeline of
+// `xsort_external()`, which reads every record before rewriting the
+// file from the start, so a failure during that final merge leaves the
+// file's contents unspecified. The file must not be truncated while it is
+// being sorted. Returns 0 on success, or -1 with `errno` set, to `EINVAL`
+// if the file's length is not a multiple of `record_size`
+int xsort_file(const char *path, size_t record_size, size_t memory_budget, cmp_ctx_fn_t cmp, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file xsort_compat.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Compiler builtins `xsort` relies on, with portable fallbacks
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * GCC and Clang use their builtins directly, MSVC its intrinsics, and
+ * any other compiler plain C that gives the same results.
+ *
+ */
+
+#pragma once
+
+#include "xsort.h"
+
+#if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+    #define XSORT_COMPAT_MSVC
+#endif
+
+// Read a flag published by `xsort_flag_store()`, with acquire ordering
+static inline bool xsort_flag_load(bool *flag)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+#elif defined(XSORT_COMPAT_MSVC)
+    return _InterlockedOr8((volatile char *)flag, 0) != 0;
+#else
+    return *(volatile bool *)flag;
+#endif
+}
+
+// Set a flag once the data it guards has been written, with release ordering
+static inline void xsort_flag_store(bool *flag, bool value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(flag, value, __ATOMIC_RELEASE);
+#elif defined(XSORT_COMPAT_MSVC)
+    _InterlockedExchange8((volatile char *)flag, (char)value);
+#else
+    *(volatile bool *)flag = value;
+#endif
+}
+
+// Leading zero bits of `x`, which must be non-zero
+static inline unsigned xsort_clz64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_clzll(x);
+#elif defined(XSORT_COMPAT_MSVC) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - (unsigned)index;
+#else
+    unsigned n = 0;
+    for (unsigned shift = 32; shift; shift /= 2) {
+        if (!(x >> (64 - shift))) {
+            n += shift;
+            x <<= shift;
+        }
+    }
+    return n;
+#endif
+}
+
+// Trailing zero bits of `x`, which must be non-zero
+static inline unsigned xsort_ctz64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#elif defined(XSORT_COMPAT_MSVC) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (unsigned)index;
+#else
+    return 63 - xsort_clz64(x & (0 - x));
+#endif
+}
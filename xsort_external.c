@@ -0,0 +1,569 @@
+/**
+ * @file xsort_external.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Out-of-core context-supported sorting for `frappe`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ */
+
+// `mkstemp()`, `PATH_MAX` and `O_CLOEXEC` are POSIX rather than ISO C
+#define _POSIX_C_SOURCE 200809L
+
+#include "xsort.h"
+#include "xsort_merge.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+typedef struct cmp_ctx_t {
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} cmp_ctx_t;
+
+// Smallest read or write issued against a run, in bytes. Below this the
+// merge is dominated by syscall overhead and seeks between runs
+#define EXTERNAL_MIN_BUFFER (1 << 20)
+
+// Budgets smaller than this are raised to it
+#define EXTERNAL_MIN_BUDGET (4 * EXTERNAL_MIN_BUFFER)
+
+// Largest single `read()` or `write()` request, in bytes
+#define EXTERNAL_MAX_IO (1 << 30)
+
+// Budget assumed by `xsort_file()` when the system does not report its
+// physical memory
+#define FILE_DEFAULT_BUDGET ((size_t)1 << 30)
+
+// Sorted run spilled to an unlinked temporary file
+typedef struct run_t {
+    int fd;
+    size_t elements;
+} run_t;
+
+// Buffered cursor over a run of `size`-byte records during a merge
+typedef struct source_t {
+    int fd;
+    uint8_t *buf;
+    size_t size;
+    // Counted in records
+    size_t capacity;
+    size_t head;
+    size_t count;
+    // Records of the run not yet read into `buf`
+    size_t remaining;
+} source_t;
+
+
+#pragma region I/O
+
+// Close every run, preserving `errno` for the caller
+static void close_runs(run_t *runs, size_t count)
+{
+    int saved = errno;
+    for (size_t i = 0; i < count; i++) {
+        close(runs[i].fd);
+    }
+    errno = saved;
+}
+
+// Read up to `bytes` bytes, stopping early only at end of file.
+// Returns the number of bytes read, or -1 on error
+static ssize_t read_full(int fd, void *buf, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes) {
+        size_t chunk = bytes - done < EXTERNAL_MAX_IO ? bytes - done : EXTERNAL_MAX_IO;
+        ssize_t n = read(fd, (uint8_t *)buf + done, chunk);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!n) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static int write_full(int fd, const void *buf, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes) {
+        size_t chunk = bytes - done < EXTERNAL_MAX_IO ? bytes - done : EXTERNAL_MAX_IO;
+        ssize_t n = write(fd, (const uint8_t *)buf + done, chunk);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// Create an anonymous spill file under `$TMPDIR`, or `/tmp` if unset.
+// The file is unlinked immediately and disappears once `fd` is closed
+static int spill_open(void)
+{
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) {
+        dir = "/tmp";
+    }
+
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/xsort-XXXXXX", dir) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+// Rewind a finished spill file for sequential reading
+static int spill_rewind(int fd)
+{
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return 0;
+}
+
+#pragma endregion
+
+
+#pragma region K-way merge
+
+static int source_refill(source_t *src)
+{
+    size_t n = src->remaining < src->capacity ? src->remaining : src->capacity;
+    ssize_t got = read_full(src->fd, src->buf, n * src->size);
+    if (got < 0) {
+        return -1;
+    }
+    if ((size_t)got != n * src->size) {
+        errno = EIO;
+        return -1;
+    }
+    src->head = 0;
+    src->count = n;
+    src->remaining -= n;
+    return 0;
+}
+
+// Merge `k` spilled runs of `size`-byte records into `out_fd`, splitting
+// `buffer` of `buffer_elements` records evenly between the runs and the
+// output. Runs are closed whether or not the merge succeeds
+static int merge_runs(run_t *runs, size_t k, int out_fd, uint8_t *buffer, size_t buffer_elements, size_t size, cmp_ctx_t *ctx)
+{
+    size_t capacity = buffer_elements / (k + 1);
+    source_t *srcs = malloc(k * sizeof(source_t));
+    const void **head = malloc(k * sizeof(void *));
+    uint8_t *out = &buffer[k * capacity * size];
+    size_t pending = 0;
+    int status = 0;
+
+    if (unlikely(!srcs || !head)) {
+        free(head);
+        free(srcs);
+        close_runs(runs, k);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        srcs[i] = (source_t) {
+            .fd = runs[i].fd,
+            .buf = &buffer[i * capacity * size],
+            .size = size,
+            .capacity = capacity,
+            .remaining = runs[i].elements,
+        };
+        if (!status && (spill_rewind(srcs[i].fd) || source_refill(&srcs[i]))) {
+            status = -1;
+        }
+        head[i] = srcs[i].count ? srcs[i].buf : NULL;
+    }
+
+    loser_tree_t lt = { 0 };
+    if (!status && unlikely(!loser_tree_init(&lt, head, k, ctx->cmp, ctx->arg))) {
+        errno = ENOMEM;
+        status = -1;
+    }
+
+    while (!status) {
+        size_t top = loser_tree_top(&lt);
+        if (!head[top]) {
+            break;
+        }
+
+        source_t *src = &srcs[top];
+        memcpy(&out[pending++ * size], &src->buf[src->head++ * size], size);
+        if (pending == capacity) {
+            status = write_full(out_fd, out, pending * size);
+            pending = 0;
+        }
+
+        if (src->head == src->count) {
+            if (src->remaining && !status) {
+                status = source_refill(src);
+            }
+            else {
+                src->count = 0;
+            }
+        }
+        head[top] = src->count ? &src->buf[src->head * size] : NULL;
+        loser_tree_replay(&lt);
+    }
+
+    if (!status && pending) {
+        status = write_full(out_fd, out, pending * size);
+    }
+
+    if (lt.node) {
+        loser_tree_destroy(&lt);
+    }
+    close_runs(runs, k);
+
+    free(head);
+    free(srcs);
+    return status;
+}
+
+#pragma endregion
+
+
+#pragma region Run formation
+
+// Sort the input a budget-sized chunk of `chunk` records at a time,
+// spilling each sorted chunk as a run. Input that fits in one chunk is
+// written straight to `out_fd` and yields no runs
+static int form_runs(int in_fd, int out_fd, size_t chunk, size_t size, run_t **runs_out, size_t *count_out, cmp_ctx_t *ctx)
+{
+    uint8_t *data = malloc(chunk * size);
+    if (unlikely(!data)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // A workspace that cannot be reserved only slows the sorts down
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    xsort_workspace_reserve(&ws, (chunk * size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+
+    run_t *runs = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int status = 0;
+
+    for (;;) {
+        ssize_t got = read_full(in_fd, data, chunk * size);
+        if (got < 0) {
+            status = -1;
+            break;
+        }
+        if ((size_t)got % size) {
+            errno = EINVAL;
+            status = -1;
+            break;
+        }
+
+        size_t elements = (size_t)got / size;
+        if (!elements) {
+            break;
+        }
+        if (xsort_sized_ws(data, elements, size, ctx->cmp, ctx->arg, &ws)) {
+            status = -1;
+            break;
+        }
+
+        // A short first chunk is the whole input
+        if (!count && elements < chunk) {
+            status = write_full(out_fd, data, elements * size);
+            break;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            run_t *grown = realloc(runs, capacity * sizeof(run_t));
+            if (unlikely(!grown)) {
+                errno = ENOMEM;
+                status = -1;
+                break;
+            }
+            runs = grown;
+        }
+
+        int fd = spill_open();
+        if (fd < 0) {
+            status = -1;
+            break;
+        }
+        runs[count++] = (run_t) { .fd = fd, .elements = elements };
+        if (write_full(fd, data, elements * size)) {
+            status = -1;
+            break;
+        }
+        if (elements < chunk) {
+            break;
+        }
+    }
+
+    xsort_workspace_destroy(&ws);
+    free(data);
+
+    if (status) {
+        close_runs(runs, count);
+        free(runs);
+        return -1;
+    }
+
+    *runs_out = runs;
+    *count_out = count;
+    return 0;
+}
+
+#pragma endregion
+
+
+// Scratch bytes per record that `xsort_sized_ws()` needs beside the records
+static size_t record_scratch(size_t size)
+{
+    return size == 4 || size == 8 || size == 16 || size == 32 ? size : 2 * sizeof(uint64_t);
+}
+
+// Sort the `size`-byte records read from `in_fd` into `out_fd`. The input
+// is read in full before anything is written
+static int external_sort(int in_fd, int out_fd, size_t size, size_t memory_budget, cmp_ctx_t *ctx)
+{
+    if (memory_budget < EXTERNAL_MIN_BUDGET) {
+        memory_budget = EXTERNAL_MIN_BUDGET;
+    }
+    if (memory_budget / 4 < size) {
+        if (unlikely(size > SIZE_MAX / 4)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memory_budget = 4 * size;
+    }
+
+    // Each in-core sort needs its records and the scratch space for them
+    size_t chunk = memory_budget / (size + record_scratch(size));
+
+    run_t *runs = NULL;
+    size_t count = 0;
+    if (form_runs(in_fd, out_fd, chunk, size, &runs, &count, ctx)) {
+        return -1;
+    }
+    if (!count) {
+        free(runs);
+        return 0;
+    }
+
+    // Merge as many runs at once as the budget allows while keeping every
+    // buffer, including the output's, at least `EXTERNAL_MIN_BUFFER` bytes
+    // and one record
+    size_t buffer_elements = memory_budget / size;
+    size_t fan_in = memory_budget / (size > EXTERNAL_MIN_BUFFER ? size : EXTERNAL_MIN_BUFFER) - 1;
+    uint8_t *buffer = malloc(buffer_elements * size);
+    if (unlikely(!buffer)) {
+        close_runs(runs, count);
+        free(runs);
+        errno = ENOMEM;
+        return -1;
+    }
+    int status = 0;
+
+    while (!status && count > fan_in) {
+        size_t merged = 0;
+        size_t i = 0;
+        for (; i < count; i += fan_in) {
+            size_t k = count - i < fan_in ? count - i : fan_in;
+            size_t elements = 0;
+            for (size_t j = 0; j < k; j++) {
+                elements += runs[i + j].elements;
+            }
+
+            int fd = spill_open();
+            if (fd < 0 || merge_runs(&runs[i], k, fd, buffer, buffer_elements, size, ctx)) {
+                status = -1;
+                if (fd >= 0) {
+                    close(fd);
+                }
+                else {
+                    // `merge_runs()` was skipped, so these are still open
+                    close_runs(&runs[i], k);
+                }
+                i += k;
+                break;
+            }
+            runs[merged++] = (run_t) { .fd = fd, .elements = elements };
+        }
+
+        if (status) {
+            close_runs(runs, merged);
+            close_runs(&runs[i], count - i);
+        }
+        count = merged;
+    }
+
+    if (!status) {
+        status = merge_runs(runs, count, out_fd, buffer, buffer_elements, size, ctx);
+    }
+
+    free(buffer);
+    free(runs);
+    return status;
+}
+
+int xsort_external(int in_fd, int out_fd, size_t memory_budget, cmp_ctx_fn_t cmp, void *arg)
+{
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+    return external_sort(in_fd, out_fd, sizeof(uint64_t), memory_budget, &ctx);
+}
+
+
+#pragma region Memory-mapped files
+
+// Half of physical memory, or `FILE_DEFAULT_BUDGET` if that is unknown
+static size_t file_default_budget(void)
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0 && (size_t)pages <= SIZE_MAX / (size_t)page_size) {
+        return (size_t)pages * (size_t)page_size / 2;
+    }
+#endif
+    return FILE_DEFAULT_BUDGET;
+}
+
+// Sort the `elements` records of the open file `fd` through a shared
+// mapping, so the sorted order is written back by the page cache. Sets
+// `*mapped` to false without touching the file if it cannot be mapped
+static int file_sort_mapped(int fd, size_t bytes, size_t elements, size_t size, cmp_ctx_t *ctx, bool *mapped)
+{
+    void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    *mapped = map != MAP_FAILED;
+    if (!*mapped) {
+        return -1;
+    }
+
+    // Every merge pass sweeps the whole file, so read it in up front
+    // rather than faulting it in a page at a time on the first pass
+#ifdef POSIX_MADV_WILLNEED
+    posix_madvise(map, bytes, POSIX_MADV_WILLNEED);
+#endif
+
+    xsort_workspace_t ws;
+    xsort_workspace_init(&ws);
+    int status = xsort_sized_ws(map, elements, size, ctx->cmp, ctx->arg, &ws);
+    xsort_workspace_destroy(&ws);
+
+    int saved = errno;
+    munmap(map, bytes);
+    errno = saved;
+    return status;
+}
+
+// Sort the file at `path`, already open as `fd`, through the external
+// pipeline: every record is read from `fd` and spilled before the merged
+// output overwrites the file from its start
+static int file_sort_external(int fd, const char *path, size_t size, size_t memory_budget, cmp_ctx_t *ctx)
+{
+    int out_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (out_fd < 0) {
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    int status = external_sort(fd, out_fd, size, memory_budget, ctx);
+    if (close(out_fd) && !status) {
+        status = -1;
+    }
+    return status;
+}
+
+// Sort the records of the file at `path`, open for reading and writing as
+// `fd`, in memory if it fits the budget and externally otherwise
+static int file_sort(int fd, const char *path, size_t size, size_t memory_budget, cmp_ctx_t *ctx)
+{
+    struct stat st;
+    if (fstat(fd, &st)) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size % size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely((uint64_t)st.st_size > SIZE_MAX)) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    size_t bytes = (size_t)st.st_size;
+    size_t elements = bytes / size;
+    if (elements < 2) {
+        return 0;
+    }
+
+    // The mapped records count against the budget along with the scratch
+    // space sorting them needs
+    if (!memory_budget) {
+        memory_budget = file_default_budget();
+    }
+    // Sorting a mapping that cannot get its scratch space leaves the file
+    // untouched, so the external pipeline can still take it
+    if (elements <= memory_budget / (size + record_scratch(size))) {
+        bool mapped;
+        int status = file_sort_mapped(fd, bytes, elements, size, ctx, &mapped);
+        if (mapped && !(status && errno == ENOMEM)) {
+            return status;
+        }
+    }
+    return file_sort_external(fd, path, size, memory_budget, ctx);
+}
+
+int xsort_file(const char *path, size_t record_size, size_t memory_budget, cmp_ctx_fn_t cmp, void *arg)
+{
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+    if (!record_size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int status = file_sort(fd, path, record_size, memory_budget, &ctx);
+    int saved = errno;
+    if (close(fd) && !status) {
+        return -1;
+    }
+    errno = saved;
+    return status;
+}
+
+#pragma endregion
@@ -0,0 +1,119 @@
+/**
+ * @file xsort_merge.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Loser tree for k-way merging in `xsort`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * The tree tracks the current head of each of `k` runs of elements.
+ * Callers consume the winner's head, advance it (or set it to NULL once its
+ * run is exhausted, which may involve refilling a buffer first) and replay,
+ * which costs one comparison per level: about log2(k) per output element.
+ * Heads are untyped, so one tree serves elements of any width, and only
+ * whether the comparator returns a negative value is ever tested, so it
+ * may be a bare less-than as the merge engine's template supplies.
+ *
+ */
+
+#pragma once
+
+#include "xsort.h"
+
+typedef struct loser_tree_t {
+    // Current element of each run, or NULL once the run is exhausted
+    const void **head;
+    // `node[0]` is the overall winner, `node[1, k)` the loser at each match
+    size_t *node;
+    size_t k;
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} loser_tree_t;
+
+// Whether run `a` currently outranks run `b`. Exhausted runs lose to
+// everything, and ties go to the lower-numbered run to keep merges stable,
+// which takes a single comparison in whichever direction settles them
+static inline bool loser_tree_before(const loser_tree_t *lt, size_t a, size_t b)
+{
+    if (!lt->head[a]) {
+        return false;
+    }
+    if (!lt->head[b]) {
+        return true;
+    }
+    if (a < b) {
+        return !(lt->cmp(lt->head[b], lt->head[a], lt->arg) < 0);
+    }
+    return lt->cmp(lt->head[a], lt->head[b], lt->arg) < 0;
+}
+
+// Build the tree over `head[0, k)`, with `k` at least one, in the caller's
+// `node`, which holds `k` entries, using `winner`, which holds `2 * k`, as
+// scratch. Leaf `i` sits at position `k + i` of an implicit heap, so every
+// `k` yields a full tree
+static inline void loser_tree_build(loser_tree_t *lt, const void **head, size_t *node, size_t *winner, size_t k, cmp_ctx_fn_t cmp, void *arg)
+{
+    *lt = (loser_tree_t) {
+        .head = head,
+        .node = node,
+        .k = k,
+        .cmp = cmp,
+        .arg = arg,
+    };
+
+    for (size_t i = 0; i < k; i++) {
+        winner[k + i] = i;
+    }
+    for (size_t p = k - 1; p > 0; p--) {
+        size_t a = winner[2 * p];
+        size_t b = winner[2 * p + 1];
+        bool a_wins = loser_tree_before(lt, a, b);
+        winner[p] = a_wins ? a : b;
+        node[p] = a_wins ? b : a;
+    }
+    node[0] = k > 1 ? winner[1] : 0;
+}
+
+// As `loser_tree_build()`, allocating the tree, which must then be released
+// with `loser_tree_destroy()`. Returns false if it could not be allocated
+static __unused bool loser_tree_init(loser_tree_t *lt, const void **head, size_t k, cmp_ctx_fn_t cmp, void *arg)
+{
+    size_t *node = malloc(k * sizeof(size_t));
+    size_t *winner = malloc(2 * k * sizeof(size_t));
+    if (unlikely(!node || !winner)) {
+        free(node);
+        free(winner);
+        *lt = (loser_tree_t) { 0 };
+        return false;
+    }
+    loser_tree_build(lt, head, node, winner, k, cmp, arg);
+    free(winner);
+    return true;
+}
+
+// Run currently holding the smallest head; its head is NULL once every run is exhausted
+static inline size_t loser_tree_top(const loser_tree_t *lt)
+{
+    return lt->node[0];
+}
+
+// Restore the tree after the head of `loser_tree_top()` has changed
+static inline void loser_tree_replay(loser_tree_t *lt)
+{
+    size_t winner = lt->node[0];
+    for (size_t p = (lt->k + winner) / 2; p > 0; p /= 2) {
+        if (loser_tree_before(lt, lt->node[p], winner)) {
+            size_t tmp = lt->node[p];
+            lt->node[p] = winner;
+            winner = tmp;
+        }
+    }
+    lt->node[0] = winner;
+}
+
+static __unused void loser_tree_destroy(loser_tree_t *lt)
+{
+    free(lt->node);
+    *lt = (loser_tree_t) { 0 };
+}
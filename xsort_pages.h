@@ -0,0 +1,161 @@
+/**
+ * @file xsort_pages.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Huge-page backed, NUMA-placed scratch buffers for large sorts
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Buffers are anonymous mappings backed by explicit huge pages when the
+ * system has some reserved, and otherwise by transparent huge pages where
+ * the kernel allows them. On Linux they can also be placed on the NUMA
+ * node holding another buffer, or interleaved across every node the
+ * process may use. Placement goes through the raw system calls, so no
+ * libnuma is needed, and like the page size it is only a hint: every step
+ * that the system refuses is skipped. Where anonymous mappings are not
+ * available, as on Windows, `pages_map()` always fails and callers fall
+ * back to the allocator.
+ *
+ */
+
+#pragma once
+
+#include "xsort.h"
+
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
+
+// Strict ISO builds on some systems hide `MAP_ANONYMOUS` along with the
+// other extensions used here
+#if defined(MAP_ANONYMOUS)
+    #define PAGES_MMAP
+#endif
+
+#if defined(__linux__) && defined(PAGES_MMAP)
+    #include <linux/mempolicy.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #if defined(SYS_mbind) && defined(SYS_get_mempolicy)
+        #define PAGES_NUMA
+    #endif
+#endif
+
+// Buffers smaller than this come from the allocator as usual; below it
+// the page tables they need stay within reach of the TLB anyway
+#define PAGES_HUGE_MIN (32 << 20)
+
+// Huge page size on x86-64 and on AArch64 with 4 KiB base pages
+#define PAGES_HUGE_SIZE (2 << 20)
+
+// Largest node count placement considers
+#define PAGES_MAX_NODES 1024
+
+#define PAGES_MASK_WORDS (PAGES_MAX_NODES / (8 * sizeof(unsigned long)))
+
+// Map at least `bytes` bytes aligned to a huge page and store the length
+// of the mapping in `*mapped`. Returns NULL with `errno` set to `ENOMEM`
+// on failure
+static void *pages_map(__unused size_t bytes, __unused size_t *mapped)
+{
+#ifdef PAGES_MMAP
+    if (unlikely(bytes > SIZE_MAX - 2 * PAGES_HUGE_SIZE)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t len = (bytes + PAGES_HUGE_SIZE - 1) & ~(size_t)(PAGES_HUGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    void *huge = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED) {
+        *mapped = len;
+        return huge;
+    }
+#endif
+
+    // Over-map by a huge page and trim both ends, so that transparent huge
+    // pages can back the whole buffer
+    uint8_t *raw = mmap(NULL, len + PAGES_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (unlikely(raw == MAP_FAILED)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    uint8_t *ptr = (uint8_t *)(((uintptr_t)raw + PAGES_HUGE_SIZE - 1) & ~(uintptr_t)(PAGES_HUGE_SIZE - 1));
+    if (ptr > raw) {
+        munmap(raw, (size_t)(ptr - raw));
+    }
+    if (ptr + len < raw + len + PAGES_HUGE_SIZE) {
+        munmap(ptr + len, (size_t)(raw + len + PAGES_HUGE_SIZE - (ptr + len)));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    *mapped = len;
+    return ptr;
+#else
+    errno = ENOMEM;
+    return NULL;
+#endif
+}
+
+static void pages_unmap(__unused void *ptr, __unused size_t mapped)
+{
+#ifdef PAGES_MMAP
+    if (ptr) {
+        munmap(ptr, mapped);
+    }
+#endif
+}
+
+#ifdef PAGES_NUMA
+
+// Nodes the calling thread may allocate from, returning how many there are
+static size_t pages_allowed(unsigned long *mask)
+{
+    memset(mask, 0, PAGES_MASK_WORDS * sizeof(unsigned long));
+    if (syscall(SYS_get_mempolicy, NULL, mask, PAGES_MAX_NODES, NULL, MPOL_F_MEMS_ALLOWED)) {
+        return 0;
+    }
+    size_t nodes = 0;
+    for (size_t i = 0; i < PAGES_MASK_WORDS; i++) {
+        nodes += (size_t)__builtin_popcountl(mask[i]);
+    }
+    return nodes;
+}
+
+#endif
+
+// Prefer the NUMA node holding `near` for the mapping `[ptr, ptr + mapped)`,
+// migrating pages already faulted elsewhere
+static __unused void pages_bind_near(__unused void *ptr, __unused size_t mapped, __unused const void *near)
+{
+#ifdef PAGES_NUMA
+    unsigned long mask[PAGES_MASK_WORDS];
+    if (pages_allowed(mask) < 2) {
+        return;
+    }
+    int node;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, near, MPOL_F_NODE | MPOL_F_ADDR) || node < 0 || node >= PAGES_MAX_NODES) {
+        return;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, ptr, mapped, MPOL_PREFERRED, mask, PAGES_MAX_NODES, MPOL_MF_MOVE);
+#endif
+}
+
+// Spread the pages of `[ptr, ptr + mapped)` across every allowed NUMA
+// node, for buffers that threads on all of them work through
+static __unused void pages_interleave(__unused void *ptr, __unused size_t mapped)
+{
+#ifdef PAGES_NUMA
+    unsigned long mask[PAGES_MASK_WORDS];
+    if (pages_allowed(mask) < 2) {
+        return;
+    }
+    syscall(SYS_mbind, ptr, mapped, MPOL_INTERLEAVE, mask, PAGES_MAX_NODES, 0);
+#endif
+}
@@ -0,0 +1,418 @@
+/**
+ * @file xsort_parallel.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multithreaded context-supported sorting for `frappe`
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "xsort.h"
+#include "xsort_pages.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+
+typedef struct cmp_ctx_t {
+    cmp_ctx_fn_t cmp;
+    void *arg;
+} cmp_ctx_t;
+
+#define ctx_less(a, b, ctx) (((cmp_ctx_t *)(ctx))->cmp((a), (b), ((cmp_ctx_t *)(ctx))->arg) < 0)
+
+#define XSORT_NAME sort_ctx
+#define XSORT_TYPE uint64_t
+#define XSORT_LESS ctx_less
+#include "xsort_template.h"
+
+// Segments at or below this many elements are sorted by a single thread
+#define PARALLEL_GRAIN (1 << 16)
+
+// Merges are split into chunks of at least this many output elements
+#define MERGE_GRAIN (1 << 15)
+
+// Upper bound on the number of chunks a single merge is split into
+#define MERGE_CHUNKS 128
+
+// Tasks a single worker can have outstanding before it runs them inline
+#define DEQUE_CAPACITY 256
+
+
+#pragma region Work-stealing pool
+
+typedef struct pool_t pool_t;
+typedef struct worker_t worker_t;
+
+typedef enum task_kind_t {
+    TASK_SORT,
+    TASK_MERGE,
+    TASK_MERGE_CHUNK,
+} task_kind_t;
+
+typedef struct task_t {
+    task_kind_t kind;
+    uint64_t *data;
+    uint64_t *swap;
+    size_t left;
+    size_t right;
+    // Output range produced by a `TASK_MERGE_CHUNK`
+    size_t begin;
+    size_t end;
+    // Decremented once the task has finished
+    atomic_size_t *pending;
+} task_t;
+
+// Owner pushes and pops at the bottom, thieves take from the top
+typedef struct deque_t {
+    pthread_mutex_t lock;
+    size_t top;
+    size_t bottom;
+    task_t *tasks[DEQUE_CAPACITY];
+} deque_t;
+
+struct worker_t {
+    pool_t *pool;
+    size_t id;
+    pthread_t thread;
+    deque_t deque;
+};
+
+struct pool_t {
+    cmp_ctx_t *ctx;
+    size_t nthreads;
+    size_t started;
+    atomic_bool done;
+    worker_t *workers;
+};
+
+static bool deque_push(deque_t *dq, task_t *task)
+{
+    pthread_mutex_lock(&dq->lock);
+    bool ok = dq->bottom - dq->top < DEQUE_CAPACITY;
+    if (ok) {
+        dq->tasks[dq->bottom++ % DEQUE_CAPACITY] = task;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+static task_t *deque_pop(deque_t *dq)
+{
+    task_t *task = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        task = dq->tasks[--dq->bottom % DEQUE_CAPACITY];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return task;
+}
+
+static task_t *deque_steal(deque_t *dq)
+{
+    task_t *task = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        task = dq->tasks[dq->top++ % DEQUE_CAPACITY];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return task;
+}
+
+static task_t *find_task(worker_t *self)
+{
+    task_t *task = deque_pop(&self->deque);
+    pool_t *pool = self->pool;
+    for (size_t i = 1; !task && i < pool->nthreads; i++) {
+        task = deque_steal(&pool->workers[(self->id + i) % pool->nthreads].deque);
+    }
+    return task;
+}
+
+static void run_task(worker_t *self, task_t *task);
+
+// Make `task` available to idle workers, or run it immediately if
+// this worker's deque is full
+static void task_spawn(worker_t *self, task_t *task)
+{
+    if (!deque_push(&self->deque, task)) {
+        run_task(self, task);
+    }
+}
+
+// Execute pending work until every task sharing `pending` has finished
+static void task_wait(worker_t *self, atomic_size_t *pending)
+{
+    while (atomic_load_explicit(pending, memory_order_acquire)) {
+        task_t *task = find_task(self);
+        if (task) {
+            run_task(self, task);
+        }
+        else {
+            sched_yield();
+        }
+    }
+}
+
+static void *worker_main(void *ptr)
+{
+    worker_t *self = ptr;
+    while (!atomic_load_explicit(&self->pool->done, memory_order_acquire)) {
+        task_t *task = find_task(self);
+        if (task) {
+            run_task(self, task);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+#pragma endregion
+
+
+#pragma region Pool lifetime
+
+static size_t default_threads(size_t nthreads)
+{
+    if (!nthreads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = online > 0 ? (size_t)online : 1;
+    }
+    return nthreads;
+}
+
+// Start `nthreads - 1` helper threads; the calling thread participates
+// as `pool->workers[0]` until `pool_stop()`. Returns false if the workers
+// could not be allocated
+static bool pool_start(pool_t *pool, cmp_ctx_t *ctx, size_t nthreads)
+{
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    if (unlikely(!workers)) {
+        return false;
+    }
+
+    *pool = (pool_t) {
+        .ctx = ctx,
+        .nthreads = nthreads,
+        .started = 1,
+        .done = false,
+        .workers = workers,
+    };
+
+    for (size_t i = 0; i < nthreads; i++) {
+        workers[i].pool = pool;
+        workers[i].id = i;
+        pthread_mutex_init(&workers[i].deque.lock, NULL);
+    }
+
+    for (; pool->started < nthreads; pool->started++) {
+        if (pthread_create(&workers[pool->started].thread, NULL, worker_main, &workers[pool->started])) {
+            break;
+        }
+    }
+    return true;
+}
+
+static void pool_stop(pool_t *pool)
+{
+    atomic_store_explicit(&pool->done, true, memory_order_release);
+    for (size_t i = 1; i < pool->started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+    free(pool->workers);
+}
+
+#pragma endregion
+
+
+// Merge `src[0, left)` and `src[left, left + right)` into `dst` by cutting the
+// merge path into equal-length chunks, each located independently by its
+// co-rank and merged by whichever worker picks it up
+static void parallel_merge(worker_t *self, uint64_t *src, size_t left, size_t right, uint64_t *dst)
+{
+    size_t elements = left + right;
+    size_t chunks = elements / MERGE_GRAIN;
+    if (chunks > 2 * self->pool->nthreads) {
+        chunks = 2 * self->pool->nthreads;
+    }
+    if (chunks > MERGE_CHUNKS) {
+        chunks = MERGE_CHUNKS;
+    }
+
+    if (chunks <= 1) {
+        sort_ctx_merge(&src[0], left, &src[left], right, dst, self->pool->ctx);
+        return;
+    }
+
+    atomic_size_t pending = chunks;
+    task_t tasks[MERGE_CHUNKS];
+    for (size_t i = 0; i < chunks; i++) {
+        tasks[i] = (task_t) {
+            .kind = TASK_MERGE_CHUNK,
+            .data = src,
+            .swap = dst,
+            .left = left,
+            .right = right,
+            .begin = elements * i / chunks,
+            .end = elements * (i + 1) / chunks,
+            .pending = &pending
+        };
+    }
+    for (size_t i = 1; i < chunks; i++) {
+        task_spawn(self, &tasks[i]);
+    }
+    run_task(self, &tasks[0]);
+    task_wait(self, &pending);
+}
+
+static void merge_chunk(worker_t *self, task_t *task)
+{
+    cmp_ctx_t *ctx = self->pool->ctx;
+    uint64_t *left = &task->data[0];
+    uint64_t *right = &task->data[task->left];
+
+    size_t i_begin = sort_ctx_corank(task->begin, left, task->left, right, task->right, ctx);
+    size_t i_end = sort_ctx_corank(task->end, left, task->left, right, task->right, ctx);
+    size_t j_begin = task->begin - i_begin;
+    size_t j_end = task->end - i_end;
+
+    sort_ctx_merge(&left[i_begin], i_end - i_begin, &right[j_begin], j_end - j_begin, &task->swap[task->begin], ctx);
+}
+
+// Sort `elements` elements of `data`, forking the four quarter sorts and
+// the merges whenever the segment is large enough to split
+static void parallel_sort(worker_t *self, uint64_t *data, uint64_t *swap, size_t elements)
+{
+    cmp_ctx_t *ctx = self->pool->ctx;
+
+    if (elements <= PARALLEL_GRAIN) {
+        sort_ctx(data, elements, swap, ctx);
+        return;
+    }
+
+    segment_t segment;
+    partition_array(elements, &segment);
+
+    atomic_size_t pending = 3;
+    task_t quarters[3] = {
+        { .kind = TASK_SORT, .data = &data[segment.q1], .swap = &swap[segment.q1], .left = segment.q2, .pending = &pending },
+        { .kind = TASK_SORT, .data = &data[segment.lh], .swap = &swap[segment.lh], .left = segment.q3, .pending = &pending },
+        { .kind = TASK_SORT, .data = &data[segment.lh + segment.q3], .swap = &swap[segment.lh + segment.q3], .left = segment.q4, .pending = &pending },
+    };
+    for (size_t i = 0; i < 3; i++) {
+        task_spawn(self, &quarters[i]);
+    }
+    parallel_sort(self, &data[0], &swap[0], segment.q1);
+    task_wait(self, &pending);
+
+    if (!ctx_less(&data[segment.q1], &data[segment.q1 - 1], ctx)) {
+        if (!ctx_less(&data[segment.lh], &data[segment.lh - 1], ctx)) {
+            if (!ctx_less(&data[segment.lh + segment.q3], &data[segment.lh + segment.q3 - 1], ctx)) {
+                return;
+            }
+        }
+    }
+
+    atomic_store_explicit(&pending, 1, memory_order_relaxed);
+    task_t merge = {
+        .kind = TASK_MERGE,
+        .data = &data[segment.lh],
+        .swap = &swap[segment.lh],
+        .left = segment.q3,
+        .right = segment.q4,
+        .pending = &pending
+    };
+    task_spawn(self, &merge);
+    parallel_merge(self, &data[0], segment.q1, segment.q2, &swap[0]);
+    task_wait(self, &pending);
+
+    parallel_merge(self, &swap[0], segment.lh, segment.rh, &data[0]);
+}
+
+static void run_task(worker_t *self, task_t *task)
+{
+    atomic_size_t *pending = task->pending;
+    switch (task->kind) {
+        case TASK_SORT:
+            parallel_sort(self, task->data, task->swap, task->left);
+            break;
+        case TASK_MERGE:
+            parallel_merge(self, task->data, task->left, task->right, task->swap);
+            break;
+        case TASK_MERGE_CHUNK:
+            merge_chunk(self, task);
+            break;
+    }
+    // `task` may be released by its owner as soon as this is observed
+    atomic_fetch_sub_explicit(pending, 1, memory_order_release);
+}
+
+void xsort_parallel(void *ptr, size_t elements, cmp_ctx_fn_t cmp, void *arg, size_t nthreads)
+{
+    nthreads = default_threads(nthreads);
+    if (nthreads == 1 || elements <= PARALLEL_GRAIN) {
+        xsort(ptr, elements, cmp, arg);
+        return;
+    }
+
+    // Large swap buffers are mapped on huge pages and interleaved across
+    // NUMA nodes, since workers on every node stream through them.
+    // Without room for a full swap buffer or the pool, the sequential
+    // sort's own fallbacks take over
+    uint64_t *swap = NULL;
+    size_t mapped = 0;
+    if (elements <= SIZE_MAX / sizeof(uint64_t)) {
+        size_t bytes = elements * sizeof(uint64_t);
+        if (bytes >= PAGES_HUGE_MIN && (swap = pages_map(bytes, &mapped))) {
+            pages_interleave(swap, mapped);
+        }
+        else {
+            swap = malloc(bytes);
+        }
+    }
+    pool_t pool;
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+    if (unlikely(!swap || !pool_start(&pool, &ctx, nthreads))) {
+        xsort(ptr, elements, cmp, arg);
+    }
+    else {
+        parallel_sort(&pool.workers[0], ptr, swap, elements);
+        pool_stop(&pool);
+    }
+
+    if (mapped) {
+        pages_unmap(swap, mapped);
+    }
+    else {
+        free(swap);
+    }
+}
+
+void xmerge_parallel(const void *src, size_t left, size_t right, void *dst, cmp_ctx_fn_t cmp, void *arg, size_t nthreads)
+{
+    cmp_ctx_t ctx = { .cmp = cmp, .arg = arg };
+    const uint64_t *runs = src;
+
+    nthreads = default_threads(nthreads);
+    if (nthreads == 1 || left + right <= 2 * MERGE_GRAIN) {
+        sort_ctx_merge(&runs[0], left, &runs[left], right, dst, &ctx);
+        return;
+    }
+
+    pool_t pool;
+    if (unlikely(!pool_start(&pool, &ctx, nthreads))) {
+        sort_ctx_merge(&runs[0], left, &runs[left], right, dst, &ctx);
+        return;
+    }
+    parallel_merge(&pool.workers[0], (uint64_t *)runs, left, right, dst);
+    pool_stop(&pool);
+}
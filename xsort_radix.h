@@ -0,0 +1,244 @@
+/**
+ * @file xsort_radix.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Radix sorting for the key-only `xsort` paths
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Values are ordered by an unsigned 64-bit key derived from their bits on
+ * every pass, so the sorted array holds the original values. The LSD sort
+ * distributes by 8, 11 or 16-bit digits covering only the bits that vary
+ * across the input; the MSD sort splits on 8-bit digits from the top and
+ * hands buckets that become small to the comparison engine. Both are
+ * stable and both need a swap buffer as long as the input.
+ *
+ */
+
+#pragma once
+
+#include "xsort.h"
+#include "xsort_compat.h"
+
+// Inputs shorter than this are always left to the merge engine
+#define RADIX_MIN_ELEMENTS (1 << 12)
+
+// MSD buckets at or below this size are finished by the comparison sort
+#define RADIX_MSD_LEAF 256
+
+#define RADIX_MSD_BITS 8
+
+typedef enum radix_kind_t {
+    RADIX_U64,
+    RADIX_I64,
+    RADIX_F64,
+} radix_kind_t;
+
+typedef enum radix_method_t {
+    RADIX_NONE,
+    RADIX_LSD,
+    RADIX_MSD,
+} radix_method_t;
+
+// Comparison sort used for MSD buckets, with `swap` as long as `data`
+typedef void (*radix_leaf_fn_t)(uint64_t *data, size_t elements, uint64_t *swap);
+
+// How an input should be sorted, and which key bits vary across it
+typedef struct radix_plan_t {
+    radix_method_t method;
+    // Varying key bits span `[lo, hi)`
+    unsigned lo;
+    unsigned hi;
+    // LSD digit width
+    unsigned bits;
+} radix_plan_t;
+
+// Unsigned key ordering `bits` like the corresponding comparison sort.
+// Doubles map -0.0 onto +0.0 and every NaN onto the largest key, so both
+// groups keep their original order as they do under `sort_f64`
+static inline uint64_t radix_key(uint64_t bits, radix_kind_t kind)
+{
+    const uint64_t sign = UINT64_C(1) << 63;
+    switch (kind) {
+        case RADIX_I64:
+            return bits ^ sign;
+        case RADIX_F64: {
+            uint64_t key = (bits & sign) ? ~bits : bits | sign;
+            key = (bits << 1) ? key : sign;
+            return (bits & ~sign) > UINT64_C(0x7ff0000000000000) ? UINT64_MAX : key;
+        }
+        default:
+            return bits;
+    }
+}
+
+// Decide between the radix sorts and the merge engine. Short inputs and
+// inputs that are already nearly sorted either way go to the merge engine,
+// which finishes the latter in a single pass over their natural runs. The
+// rest are sorted LSD unless MSD would need fewer passes, which happens
+// when the keys carry many more varying bits than `elements` needs
+static radix_plan_t radix_plan(const uint64_t *data, size_t elements, radix_kind_t kind)
+{
+    radix_plan_t plan = { .method = RADIX_NONE };
+    if (elements < RADIX_MIN_ELEMENTS) {
+        return plan;
+    }
+
+    uint64_t first = radix_key(data[0], kind);
+    uint64_t prev = first;
+    uint64_t varying = 0;
+    size_t ascents = 0;
+    size_t descents = 0;
+    for (size_t i = 1; i < elements; i++) {
+        uint64_t key = radix_key(data[i], kind);
+        varying |= key ^ first;
+        ascents += key > prev;
+        descents += key < prev;
+        prev = key;
+    }
+
+    size_t presorted = elements / 1024;
+    if (!varying || ascents <= presorted || descents <= presorted) {
+        return plan;
+    }
+
+    plan.lo = xsort_ctz64(varying);
+    plan.hi = 64 - xsort_clz64(varying);
+    unsigned span = plan.hi - plan.lo;
+
+    // Wider digits save passes, but their histograms must stay small
+    // against the input. Ties go to the narrower digit
+    plan.bits = 8;
+    unsigned passes = (span + 7) / 8;
+    if (elements >= (1 << 16) && (span + 10) / 11 < passes) {
+        plan.bits = 11;
+        passes = (span + 10) / 11;
+    }
+    if (elements >= (1 << 22) && (span + 15) / 16 < passes) {
+        plan.bits = 16;
+        passes = (span + 15) / 16;
+    }
+
+    // Uniform keys leave MSD buckets short enough for the comparison sort
+    // after about this many levels, or once the varying bits run out
+    unsigned log2n = 63 - xsort_clz64(elements);
+    unsigned levels = (log2n - 8 + RADIX_MSD_BITS - 1) / RADIX_MSD_BITS;
+    if ((span + RADIX_MSD_BITS - 1) / RADIX_MSD_BITS < levels) {
+        levels = (span + RADIX_MSD_BITS - 1) / RADIX_MSD_BITS;
+    }
+    plan.method = levels < passes ? RADIX_MSD : RADIX_LSD;
+    return plan;
+}
+
+// Sort `data` by key bits `[lo, hi)` a `bits`-wide digit at a time,
+// least significant first, alternating between `data` and `swap`. `hist`
+// needs room for one counter per bucket of every digit
+static void radix_lsd(uint64_t *data, uint64_t *swap, size_t *hist, size_t elements, const radix_plan_t *plan, radix_kind_t kind)
+{
+    unsigned bits = plan->bits;
+    unsigned digits = (plan->hi - plan->lo + bits - 1) / bits;
+    size_t buckets = (size_t)1 << bits;
+    uint64_t mask = buckets - 1;
+
+    // Every histogram comes from a single read of the input
+    memset(hist, 0, digits * buckets * sizeof(size_t));
+    for (size_t i = 0; i < elements; i++) {
+        uint64_t key = radix_key(data[i], kind) >> plan->lo;
+        for (unsigned d = 0; d < digits; d++) {
+            hist[d * buckets + ((key >> (d * bits)) & mask)]++;
+        }
+    }
+
+    uint64_t *src = data;
+    uint64_t *dst = swap;
+    for (unsigned d = 0; d < digits; d++) {
+        size_t *count = &hist[d * buckets];
+        unsigned shift = plan->lo + d * bits;
+
+        // A digit every key shares would only copy the array
+        if (count[(radix_key(src[0], kind) >> shift) & mask] == elements) {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t b = 0; b < buckets; b++) {
+            size_t n = count[b];
+            count[b] = offset;
+            offset += n;
+        }
+        for (size_t i = 0; i < elements; i++) {
+            dst[count[(radix_key(src[i], kind) >> shift) & mask]++] = src[i];
+        }
+
+        uint64_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != data) {
+        memcpy(data, src, elements * sizeof(uint64_t));
+    }
+}
+
+// Sort `src` by the key bits below `shift + RADIX_MSD_BITS`, all higher
+// bits being shared, and leave the result in `alt` if `to_alt` is set,
+// otherwise in `src`. Each level distributes into the other buffer, so
+// elements move once per digit plus at most once more at a leaf
+static void radix_msd(uint64_t *src, uint64_t *alt, size_t elements, unsigned shift, unsigned lo, bool to_alt, radix_kind_t kind, radix_leaf_fn_t leaf)
+{
+    const size_t buckets = (size_t)1 << RADIX_MSD_BITS;
+    const uint64_t mask = buckets - 1;
+
+    for (;;) {
+        if (elements <= RADIX_MSD_LEAF) {
+            leaf(src, elements, alt);
+            break;
+        }
+
+        size_t count[1 << RADIX_MSD_BITS] = { 0 };
+        for (size_t i = 0; i < elements; i++) {
+            count[(radix_key(src[i], kind) >> shift) & mask]++;
+        }
+
+        // Remaining bits below `lo` are the same for every key
+        bool last = shift <= lo;
+        unsigned next = shift > RADIX_MSD_BITS ? shift - RADIX_MSD_BITS : 0;
+
+        if (count[(radix_key(src[0], kind) >> shift) & mask] == elements) {
+            if (last) {
+                break;
+            }
+            shift = next;
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t b = 0; b < buckets; b++) {
+            size_t n = count[b];
+            count[b] = offset;
+            offset += n;
+        }
+        for (size_t i = 0; i < elements; i++) {
+            alt[count[(radix_key(src[i], kind) >> shift) & mask]++] = src[i];
+        }
+
+        // `count[b]` now marks the end of bucket `b` in `alt`
+        size_t start = 0;
+        for (size_t b = 0; b < buckets; b++) {
+            size_t n = count[b] - start;
+            if (n > 1 && !last) {
+                radix_msd(&alt[start], &src[start], n, next, lo, !to_alt, kind, leaf);
+            }
+            else if (n && !to_alt) {
+                memcpy(&src[start], &alt[start], n * sizeof(uint64_t));
+            }
+            start = count[b];
+        }
+        return;
+    }
+
+    if (to_alt) {
+        memcpy(alt, src, elements * sizeof(uint64_t));
+    }
+}
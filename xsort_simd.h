@@ -0,0 +1,491 @@
+/**
+ * @file xsort_simd.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Vectorized kernels for the key-only `xsort` paths
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Kernels operate on signed 64-bit lanes; unsigned keys are handled by
+ * flipping the sign bit on the way in and out (`bias`). x86 kernels are
+ * compiled for their target individually and selected at runtime, while
+ * NEON is part of the AArch64 baseline.
+ *
+ */
+
+#pragma once
+
+#include "xsort.h"
+#include "xsort_compat.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define XSORT_SIMD_X86
+    #include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    #define XSORT_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+// Sorts at most `elements` signed 64-bit keys in place after XOR-ing them with `bias`
+typedef void (*simd_sort_fn_t)(int64_t *data, size_t elements, uint64_t bias);
+
+// Merges two sorted runs of keys, each holding at least one register's worth
+typedef void (*simd_merge_fn_t)(const int64_t *left, size_t nl, const int64_t *right, size_t nr, int64_t *dst, uint64_t bias);
+
+// Sorts `count` arrays of keys at once, at most one per lane, each holding
+// at most `regs` keys where `regs` is a power of two from 2 to `batch_max`
+typedef void (*simd_batch_fn_t)(int64_t *const arrays[], const size_t lengths[], size_t count, size_t regs, uint64_t bias);
+
+typedef struct simd_kernels_t {
+    simd_sort_fn_t sort;
+    size_t sort_max;
+    simd_merge_fn_t merge;
+    size_t merge_min;
+    simd_batch_fn_t batch;
+    size_t batch_max;
+    size_t batch_lanes;
+} simd_kernels_t;
+
+
+#pragma region Bitonic network
+
+// Generates `prefix##_bitonic()`, which sorts the `regs * lanes` keys held in
+// `v[0, regs)` in ascending lane-major order. Relies on the `prefix`
+// primitives `min`, `max`, `rev` (reverse lanes), `flip` (compare lane `i`
+// with lane `i ^ (block - 1)`) and `xchg` (compare lane `i` with `i ^ dist`)
+#define XSORT_DEFINE_BITONIC(prefix, attr, vec_t, lanes) \
+    attr void prefix##_bitonic(vec_t *v, size_t regs) \
+    { \
+        size_t keys = regs * (lanes); \
+        for (size_t block = 2; block <= keys; block *= 2) { \
+            if (block <= (lanes)) { \
+                for (size_t r = 0; r < regs; r++) { \
+                    v[r] = prefix##_flip(v[r], block); \
+                } \
+            } \
+            else { \
+                size_t span = block / (lanes); \
+                for (size_t base = 0; base < regs; base += span) { \
+                    for (size_t k = 0; k < span / 2; k++) { \
+                        vec_t a = v[base + k]; \
+                        vec_t b = prefix##_rev(v[base + span - 1 - k]); \
+                        v[base + k] = prefix##_min(a, b); \
+                        v[base + span - 1 - k] = prefix##_rev(prefix##_max(a, b)); \
+                    } \
+                } \
+            } \
+            for (size_t dist = block / 4; dist >= 1; dist /= 2) { \
+                if (dist >= (lanes)) { \
+                    size_t span = dist / (lanes); \
+                    for (size_t r = 0; r < regs; r++) { \
+                        if (!(r & span)) { \
+                            vec_t a = v[r]; \
+                            v[r] = prefix##_min(a, v[r + span]); \
+                            v[r + span] = prefix##_max(a, v[r + span]); \
+                        } \
+                    } \
+                } \
+                else { \
+                    for (size_t r = 0; r < regs; r++) { \
+                        v[r] = prefix##_xchg(v[r], dist); \
+                    } \
+                } \
+            } \
+        } \
+    }
+
+// Generates `prefix##_sort()`, a `simd_sort_fn_t` that pads its input to
+// the next supported network size with the largest key
+#define XSORT_DEFINE_NETWORK_SORT(prefix, attr, vec_t, lanes, max_regs) \
+    attr void prefix##_sort(int64_t *data, size_t elements, uint64_t bias) \
+    { \
+        int64_t keys[(max_regs) * (lanes)]; \
+        vec_t v[max_regs]; \
+        size_t regs = 1; \
+        while (regs * (lanes) < elements) { \
+            regs *= 2; \
+        } \
+        for (size_t i = 0; i < elements; i++) { \
+            keys[i] = (int64_t)((uint64_t)data[i] ^ bias); \
+        } \
+        for (size_t i = elements; i < regs * (lanes); i++) { \
+            keys[i] = INT64_MAX; \
+        } \
+        for (size_t r = 0; r < regs; r++) { \
+            v[r] = prefix##_load(&keys[r * (lanes)]); \
+        } \
+        switch (regs) { \
+            case 1: prefix##_bitonic(v, 1); break; \
+            case 2: prefix##_bitonic(v, 2); break; \
+            case 4: prefix##_bitonic(v, 4); break; \
+            default: prefix##_bitonic(v, max_regs); break; \
+        } \
+        for (size_t r = 0; r < regs; r++) { \
+            prefix##_store(&keys[r * (lanes)], v[r]); \
+        } \
+        for (size_t i = 0; i < elements; i++) { \
+            data[i] = (int64_t)((uint64_t)keys[i] ^ bias); \
+        } \
+    }
+
+// Generates `prefix##_merge()`, a `simd_merge_fn_t` that repeatedly merges a
+// register from each run with a bitonic network, emits the lower half, and
+// refills from whichever run has the smaller next key. The tail left once
+// either run can no longer supply a full register is merged as scalars
+#define XSORT_DEFINE_MERGE(prefix, attr, vec_t, lanes) \
+    attr void prefix##_merge(const int64_t *left, size_t nl, const int64_t *right, size_t nr, int64_t *dst, uint64_t bias) \
+    { \
+        const int64_t *end_l = &left[nl]; \
+        const int64_t *end_r = &right[nr]; \
+        const vec_t vbias = prefix##_set1((int64_t)bias); \
+        vec_t lo = prefix##_xor(prefix##_load(left), vbias); \
+        vec_t hi = prefix##_xor(prefix##_load(right), vbias); \
+        left += (lanes); \
+        right += (lanes); \
+        for (;;) { \
+            hi = prefix##_rev(hi); \
+            vec_t l = prefix##_min(lo, hi); \
+            vec_t h = prefix##_max(lo, hi); \
+            for (size_t dist = (lanes) / 2; dist >= 1; dist /= 2) { \
+                l = prefix##_xchg(l, dist); \
+                h = prefix##_xchg(h, dist); \
+            } \
+            prefix##_store(dst, prefix##_xor(l, vbias)); \
+            dst += (lanes); \
+            hi = h; \
+            bool take_left = right == end_r \
+                || (left != end_l && (int64_t)((uint64_t)*left ^ bias) <= (int64_t)((uint64_t)*right ^ bias)); \
+            const int64_t **next = take_left ? &left : &right; \
+            if ((size_t)((take_left ? end_l : end_r) - *next) < (lanes)) { \
+                break; \
+            } \
+            lo = prefix##_xor(prefix##_load(*next), vbias); \
+            *next += (lanes); \
+        } \
+        int64_t tail[lanes]; \
+        prefix##_store(tail, hi); \
+        size_t t = 0; \
+        while (t < (lanes) || left != end_l || right != end_r) { \
+            int64_t key_l = left != end_l ? (int64_t)((uint64_t)*left ^ bias) : INT64_MAX; \
+            int64_t key_r = right != end_r ? (int64_t)((uint64_t)*right ^ bias) : INT64_MAX; \
+            if (t < (lanes) && tail[t] <= key_l && tail[t] <= key_r) { \
+                *dst++ = (int64_t)((uint64_t)tail[t++] ^ bias); \
+            } \
+            else if (left != end_l && key_l <= key_r) { \
+                *dst++ = *left++; \
+            } \
+            else { \
+                *dst++ = *right++; \
+            } \
+        } \
+    }
+
+// Generates `prefix##_columns()`, which sorts each lane of `v[0, regs)`
+// independently: a bitonic network over whole registers, needing only
+// vertical minimum and maximum operations
+#define XSORT_DEFINE_COLUMNS(prefix, attr, vec_t) \
+    attr void prefix##_columns(vec_t *v, size_t regs) \
+    { \
+        for (size_t block = 2; block <= regs; block *= 2) { \
+            for (size_t base = 0; base < regs; base += block) { \
+                for (size_t k = 0; k < block / 2; k++) { \
+                    vec_t a = v[base + k]; \
+                    v[base + k] = prefix##_min(a, v[base + block - 1 - k]); \
+                    v[base + block - 1 - k] = prefix##_max(a, v[base + block - 1 - k]); \
+                } \
+            } \
+            for (size_t dist = block / 4; dist >= 1; dist /= 2) { \
+                for (size_t r = 0; r < regs; r++) { \
+                    if (!(r & dist)) { \
+                        vec_t a = v[r]; \
+                        v[r] = prefix##_min(a, v[r + dist]); \
+                        v[r + dist] = prefix##_max(a, v[r + dist]); \
+                    } \
+                } \
+            } \
+        } \
+    }
+
+// Generates `prefix##_batch()`, a `simd_batch_fn_t` that transposes up to
+// `lanes` arrays so that key `r` of every array shares register `r`, pads
+// each with the largest key, and runs the column network once for them all
+#define XSORT_DEFINE_BATCH(prefix, attr, vec_t, lanes, max_regs) \
+    attr void prefix##_batch(int64_t *const arrays[], const size_t lengths[], size_t count, size_t regs, uint64_t bias) \
+    { \
+        int64_t keys[(max_regs) * (lanes)]; \
+        vec_t v[max_regs]; \
+        for (size_t j = 0; j < (lanes); j++) { \
+            size_t n = j < count ? lengths[j] : 0; \
+            for (size_t r = 0; r < n; r++) { \
+                keys[r * (lanes) + j] = (int64_t)((uint64_t)arrays[j][r] ^ bias); \
+            } \
+            for (size_t r = n; r < regs; r++) { \
+                keys[r * (lanes) + j] = INT64_MAX; \
+            } \
+        } \
+        for (size_t r = 0; r < regs; r++) { \
+            v[r] = prefix##_load(&keys[r * (lanes)]); \
+        } \
+        switch (regs) { \
+            case 2: prefix##_columns(v, 2); break; \
+            case 4: prefix##_columns(v, 4); break; \
+            case 8: prefix##_columns(v, 8); break; \
+            case 16: prefix##_columns(v, 16); break; \
+            default: prefix##_columns(v, max_regs); break; \
+        } \
+        for (size_t r = 0; r < regs; r++) { \
+            prefix##_store(&keys[r * (lanes)], v[r]); \
+        } \
+        for (size_t j = 0; j < count; j++) { \
+            for (size_t r = 0; r < lengths[j]; r++) { \
+                arrays[j][r] = (int64_t)((uint64_t)keys[r * (lanes) + j] ^ bias); \
+            } \
+        } \
+    }
+
+#pragma endregion
+
+
+#if defined(XSORT_SIMD_X86)
+
+#pragma region AVX2
+
+#define AVX2_FN static inline __attribute__((target("avx2"), always_inline))
+
+AVX2_FN __m256i avx2_load(const int64_t *ptr)
+{
+    return _mm256_loadu_si256((const __m256i *)ptr);
+}
+
+AVX2_FN void avx2_store(int64_t *ptr, __m256i v)
+{
+    _mm256_storeu_si256((__m256i *)ptr, v);
+}
+
+AVX2_FN __m256i avx2_set1(int64_t x)
+{
+    return _mm256_set1_epi64x(x);
+}
+
+AVX2_FN __m256i avx2_xor(__m256i a, __m256i b)
+{
+    return _mm256_xor_si256(a, b);
+}
+
+AVX2_FN __m256i avx2_min(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+
+AVX2_FN __m256i avx2_max(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+}
+
+AVX2_FN __m256i avx2_rev(__m256i v)
+{
+    return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+// Blend masks select 32-bit halves, so each 64-bit lane spans two bits
+AVX2_FN __m256i avx2_xchg(__m256i v, size_t dist)
+{
+    __m256i p;
+    switch (dist) {
+        case 1:
+            p = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 3, 0, 1));
+            return _mm256_blend_epi32(avx2_min(v, p), avx2_max(v, p), 0xcc);
+        default:
+            p = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+            return _mm256_blend_epi32(avx2_min(v, p), avx2_max(v, p), 0xf0);
+    }
+}
+
+AVX2_FN __m256i avx2_flip(__m256i v, size_t block)
+{
+    if (block == 2) {
+        return avx2_xchg(v, 1);
+    }
+    __m256i p = avx2_rev(v);
+    return _mm256_blend_epi32(avx2_min(v, p), avx2_max(v, p), 0xf0);
+}
+
+XSORT_DEFINE_BITONIC(avx2, AVX2_FN, __m256i, 4)
+XSORT_DEFINE_NETWORK_SORT(avx2, static __attribute__((target("avx2"))), __m256i, 4, 4)
+XSORT_DEFINE_MERGE(avx2, static __attribute__((target("avx2"))), __m256i, 4)
+XSORT_DEFINE_COLUMNS(avx2, AVX2_FN, __m256i)
+XSORT_DEFINE_BATCH(avx2, static __attribute__((target("avx2"))), __m256i, 4, 16)
+
+#pragma endregion
+
+
+#pragma region AVX-512
+
+#define AVX512_FN static inline __attribute__((target("avx512f"), always_inline))
+
+AVX512_FN __m512i avx512_load(const int64_t *ptr)
+{
+    return _mm512_loadu_si512(ptr);
+}
+
+AVX512_FN void avx512_store(int64_t *ptr, __m512i v)
+{
+    _mm512_storeu_si512(ptr, v);
+}
+
+AVX512_FN __m512i avx512_set1(int64_t x)
+{
+    return _mm512_set1_epi64(x);
+}
+
+AVX512_FN __m512i avx512_xor(__m512i a, __m512i b)
+{
+    return _mm512_xor_si512(a, b);
+}
+
+AVX512_FN __m512i avx512_min(__m512i a, __m512i b)
+{
+    return _mm512_min_epi64(a, b);
+}
+
+AVX512_FN __m512i avx512_max(__m512i a, __m512i b)
+{
+    return _mm512_max_epi64(a, b);
+}
+
+AVX512_FN __m512i avx512_rev(__m512i v)
+{
+    return _mm512_permutexvar_epi64(_mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7), v);
+}
+
+// Compare lane `i` with `lane ^ partner`, keeping the maximum in `upper` lanes
+AVX512_FN __m512i avx512_cmpx(__m512i v, __m512i partner, __mmask8 upper)
+{
+    __m512i p = _mm512_permutexvar_epi64(partner, v);
+    return _mm512_mask_blend_epi64(upper, avx512_min(v, p), avx512_max(v, p));
+}
+
+AVX512_FN __m512i avx512_xchg(__m512i v, size_t dist)
+{
+    switch (dist) {
+        case 1:
+            return avx512_cmpx(v, _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1), 0xaa);
+        case 2:
+            return avx512_cmpx(v, _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2), 0xcc);
+        default:
+            return avx512_cmpx(v, _mm512_set_epi64(3, 2, 1, 0, 7, 6, 5, 4), 0xf0);
+    }
+}
+
+AVX512_FN __m512i avx512_flip(__m512i v, size_t block)
+{
+    switch (block) {
+        case 2:
+            return avx512_xchg(v, 1);
+        case 4:
+            return avx512_cmpx(v, _mm512_set_epi64(4, 5, 6, 7, 0, 1, 2, 3), 0xcc);
+        default:
+            return avx512_cmpx(v, _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7), 0xf0);
+    }
+}
+
+XSORT_DEFINE_BITONIC(avx512, AVX512_FN, __m512i, 8)
+XSORT_DEFINE_NETWORK_SORT(avx512, static __attribute__((target("avx512f"))), __m512i, 8, 4)
+XSORT_DEFINE_MERGE(avx512, static __attribute__((target("avx512f"))), __m512i, 8)
+XSORT_DEFINE_COLUMNS(avx512, AVX512_FN, __m512i)
+XSORT_DEFINE_BATCH(avx512, static __attribute__((target("avx512f"))), __m512i, 8, 32)
+
+#pragma endregion
+
+#elif defined(XSORT_SIMD_NEON)
+
+#pragma region NEON
+
+#define NEON_FN static inline
+
+NEON_FN int64x2_t neon_load(const int64_t *ptr)
+{
+    return vld1q_s64(ptr);
+}
+
+NEON_FN void neon_store(int64_t *ptr, int64x2_t v)
+{
+    vst1q_s64(ptr, v);
+}
+
+NEON_FN int64x2_t neon_set1(int64_t x)
+{
+    return vdupq_n_s64(x);
+}
+
+NEON_FN int64x2_t neon_xor(int64x2_t a, int64x2_t b)
+{
+    return veorq_s64(a, b);
+}
+
+NEON_FN int64x2_t neon_min(int64x2_t a, int64x2_t b)
+{
+    return vbslq_s64(vcgtq_s64(a, b), b, a);
+}
+
+NEON_FN int64x2_t neon_max(int64x2_t a, int64x2_t b)
+{
+    return vbslq_s64(vcgtq_s64(a, b), a, b);
+}
+
+NEON_FN int64x2_t neon_rev(int64x2_t v)
+{
+    return vextq_s64(v, v, 1);
+}
+
+NEON_FN int64x2_t neon_xchg(int64x2_t v, __unused size_t dist)
+{
+    int64x2_t p = neon_rev(v);
+    return vcombine_s64(vget_low_s64(neon_min(v, p)), vget_high_s64(neon_max(v, p)));
+}
+
+NEON_FN int64x2_t neon_flip(int64x2_t v, __unused size_t block)
+{
+    return neon_xchg(v, 1);
+}
+
+XSORT_DEFINE_BITONIC(neon, NEON_FN, int64x2_t, 2)
+XSORT_DEFINE_NETWORK_SORT(neon, static, int64x2_t, 2, 8)
+XSORT_DEFINE_MERGE(neon, static, int64x2_t, 2)
+XSORT_DEFINE_COLUMNS(neon, NEON_FN, int64x2_t)
+XSORT_DEFINE_BATCH(neon, static, int64x2_t, 2, 16)
+
+#pragma endregion
+
+#endif
+
+
+// Select the widest kernels supported by the running processor
+static simd_kernels_t simd_probe(void)
+{
+    simd_kernels_t kernels = { 0 };
+#if defined(XSORT_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels = (simd_kernels_t) { .sort = avx512_sort, .sort_max = 32, .merge = avx512_merge, .merge_min = 8, .batch = avx512_batch, .batch_max = 32, .batch_lanes = 8 };
+    }
+    else if (__builtin_cpu_supports("avx2")) {
+        kernels = (simd_kernels_t) { .sort = avx2_sort, .sort_max = 16, .merge = avx2_merge, .merge_min = 4, .batch = avx2_batch, .batch_max = 16, .batch_lanes = 4 };
+    }
+#elif defined(XSORT_SIMD_NEON)
+    kernels = (simd_kernels_t) { .sort = neon_sort, .sort_max = 16, .merge = neon_merge, .merge_min = 2, .batch = neon_batch, .batch_max = 16, .batch_lanes = 2 };
+#endif
+    return kernels;
+}
+
+static const simd_kernels_t *simd_kernels(void)
+{
+    static simd_kernels_t kernels;
+    static bool probed;
+    if (unlikely(!xsort_flag_load(&probed))) {
+        kernels = simd_probe();
+        xsort_flag_store(&probed, true);
+    }
+    return &kernels;
+}
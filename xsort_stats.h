@@ -0,0 +1,95 @@
+/**
+ * @file xsort_stats.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Optional instrumentation for the `xsort` engine
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Building with `XSORT_STATS` defined makes the engine count comparisons
+ * per phase, shortcut hits and bytes moved by rotations into whichever
+ * `xsort_stats_t` is attached to the calling thread; `XSORT_STATS_CYCLES`
+ * additionally times each phase. Without them every hook expands to
+ * nothing.
+ *
+ */
+
+#pragma once
+
+#include "xsort.h"
+
+#if defined(XSORT_STATS_CYCLES) && !defined(XSORT_STATS)
+    #define XSORT_STATS
+#endif
+
+#ifdef XSORT_STATS
+
+    #if defined(XSORT_STATS_CYCLES) && (defined(__x86_64__) || defined(__i386__))
+        #include <x86intrin.h>
+    #elif defined(XSORT_STATS_CYCLES) && !defined(__aarch64__)
+        #include <time.h>
+    #endif
+
+// Destination for the current thread's counters, NULL when not collecting.
+// Defined once in xsort.c, so that engine instances in every translation
+// unit count into the sink the `_ws` entry points attach
+extern _Thread_local xsort_stats_t *xsort_stats_sink;
+extern _Thread_local xsort_phase_t xsort_stats_phase;
+
+static inline void xsort_stats_attach(xsort_stats_t *stats)
+{
+    xsort_stats_sink = stats;
+}
+
+static inline void xsort_stats_compare(void)
+{
+    if (xsort_stats_sink) {
+        xsort_stats_sink->compares[xsort_stats_phase]++;
+    }
+}
+
+    #define XSORT_STAT_PHASE(phase) (xsort_stats_phase = (phase))
+    #define XSORT_STAT_ADD(field, n) \
+        do { \
+            if (xsort_stats_sink) { \
+                xsort_stats_sink->field += (n); \
+            } \
+        } while (0)
+
+#else
+
+    #define xsort_stats_attach(stats) ((void)(stats))
+    #define XSORT_STAT_PHASE(phase) ((void)0)
+    #define XSORT_STAT_ADD(field, n) ((void)0)
+
+#endif
+
+#ifdef XSORT_STATS_CYCLES
+
+// Free-running tick counter: the TSC on x86, the virtual counter on
+// AArch64, and monotonic nanoseconds elsewhere
+static inline uint64_t xsort_stats_clock(void)
+{
+    #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+    #elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    #endif
+}
+
+    #define XSORT_STAT_TIMER_BEGIN() uint64_t xsort_stats_t0 = xsort_stats_sink ? xsort_stats_clock() : 0
+    #define XSORT_STAT_TIMER_END(phase) XSORT_STAT_ADD(cycles[phase], xsort_stats_clock() - xsort_stats_t0)
+
+#else
+
+    #define XSORT_STAT_TIMER_BEGIN() ((void)0)
+    #define XSORT_STAT_TIMER_END(phase) ((void)0)
+
+#endif
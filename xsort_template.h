@@ -0,0 +1,1014 @@
+/**
+ * @file xsort_template.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Compile-time specialization of the `xsort` merge engine
+ * @version 23.03
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023-2025 Jason Conway. All rights reserved.
+ *
+ * Generates a copy of the quad-merge engine for a given element type and
+ * comparison, letting the compiler inline the comparison into the sorting
+ * network and merge loops. Define the parameters below, then include this
+ * header; it may be included any number of times per translation unit.
+ *
+ *   XSORT_NAME           name of the generated sort function
+ *   XSORT_TYPE           element type
+ *   XSORT_LESS(a, b, arg) nonzero if `*a` orders strictly before `*b`
+ *
+ * Optionally, segments of up to `XSORT_LEAF_MAX` elements (evaluated once
+ * per sort) are handed to `XSORT_LEAF(data, elements, arg)` instead of the
+ * built-in odd-even network, and `XSORT_MERGE(src, dst, left, right, arg)`
+ * may take over a parity merge by returning nonzero. Defining `XSORT_GALLOP`
+ * replaces the branchless merges with galloping ones, which spend fewer
+ * comparisons when one run repeatedly wins.
+ *
+ * `XSORT_NAME_lowmem()` (the name with `_lowmem` appended) sorts with a
+ * caller-sized scratch buffer instead, merging in place by rotation
+ * wherever both runs outgrow it.
+ *
+ * The generated sort is stable. Exchanges in the sorting network, the
+ * reversal of descending runs and the rotation of out-of-order quarters
+ * all require strict inequality, and every merge takes from the left run
+ * on ties. Hooks must preserve this for elements the comparison cannot
+ * tell apart; a network over plain keys satisfies it trivially.
+ *
+ * Example:
+ *
+ *   #define XSORT_NAME sort_u32
+ *   #define XSORT_TYPE uint32_t
+ *   #define XSORT_LESS(a, b, arg) (*(a) < *(b))
+ *   #include "xsort_template.h"
+ *
+ *   // `swap` must hold at least `elements` elements
+ *   sort_u32(array, elements, swap, NULL);
+ *
+ */
+
+#include "xsort.h"
+#include "xsort_merge.h"
+#include "xsort_stats.h"
+
+#ifndef XSORT_TEMPLATE_ONCE
+#define XSORT_TEMPLATE_ONCE
+
+#define XSORT_CAT_(a, b) a##b
+#define XSORT_CAT(a, b) XSORT_CAT_(a, b)
+#define XSORT_FN(fn) XSORT_CAT(XSORT_NAME, _##fn)
+
+// Every comparison made by the engine, counted against the current phase
+// when built with `XSORT_STATS`
+#ifdef XSORT_STATS
+    #define XSORT_LT(a, b, arg) (xsort_stats_compare(), XSORT_LESS(a, b, arg))
+#else
+    #define XSORT_LT(a, b, arg) XSORT_LESS(a, b, arg)
+#endif
+
+// Bytes ahead of each merge cursor to prefetch. The hardware prefetchers
+// follow the streams within a page but not across into the next
+#define XSORT_PREFETCH_AHEAD 512
+
+// Merges of fewer bytes than this read data the caches already hold, so
+// they skip the prefetches
+#define XSORT_PREFETCH_MIN (1 << 20)
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define XSORT_PREFETCH(ptr) __builtin_prefetch((ptr), 0, 3)
+#else
+    #define XSORT_PREFETCH(ptr) ((void)(ptr))
+#endif
+
+// The engine resumes the segments on its explicit stack through GNU labels
+// as values where the compiler has them, and through a switch over resume
+// points elsewhere, including strict ISO builds such as `-std=c11`.
+// Defining `XSORT_NO_COMPUTED_GOTO` forces the switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__STRICT_ANSI__) && !defined(XSORT_NO_COMPUTED_GOTO)
+    #define XSORT_COMPUTED_GOTO
+    #define XSORT_RESUME(n) (&&ret_addr_##n)
+typedef void *xsort_resume_t;
+#else
+    #define XSORT_RESUME(n) (n)
+typedef unsigned xsort_resume_t;
+#endif
+
+// Capacity of the explicit recursion stack used by the engine. A segment
+// of `n` elements holds one continuation frame while its quarters are
+// sorted, the largest of which has `ceil(n / 4)` elements, and segments of
+// seven or fewer are sorted without splitting. Below `2^b` elements there
+// are thus at most `(b - 3) / 2 + 1` nested splits, each leaving one frame
+// behind, plus the frame of the innermost segment. For the bit width of
+// `size_t` that comes to exactly half its bits
+#define XSORT_STACK_FRAMES (sizeof(size_t) * 4)
+
+// Natural runs shorter than this are extended to this length and sorted
+// by the quad-merge engine before being merged with their neighbours
+#define XSORT_MIN_RUN 32
+
+// Inputs are only merged as natural runs if their average (extended) run
+// spans at least this many elements; anything more disordered is left to
+// the quad-merge engine, which also bounds the cost of the pre-scan
+#define XSORT_NATURAL_RUN_AVG 1024
+
+// Powersort keeps the powers on its run stack strictly increasing, so
+// the stack never exceeds one entry per bit of `size_t` plus one
+#define XSORT_RUN_STACK (sizeof(size_t) * 8 + 1)
+
+// Consecutive wins by one run before a galloping merge starts searching
+#define XSORT_MIN_GALLOP 7
+
+// Most runs a single pass of the cache-blocked schedule merges at once,
+// bounding the loser tree kept on the stack
+#define XSORT_MAX_FAN_IN 512
+
+// Node power of the boundary between the adjacent runs `[s1, s1 + n1)` and
+// `[s1 + n1, s1 + n1 + n2)` within an array of `n` elements: the number of
+// leading bits shared by the runs' midpoints as fractions of `n`, plus one
+static inline unsigned run_power(size_t s1, size_t n1, size_t n2, size_t n)
+{
+    unsigned power = 0;
+    size_t a = 2 * s1 + n1;
+    size_t b = a + n1 + n2;
+    for (;;) {
+        power++;
+        if (a >= n) {
+            a -= n;
+            b -= n;
+        }
+        else if (b >= n) {
+            break;
+        }
+        a <<= 1;
+        b <<= 1;
+    }
+    return power;
+}
+
+typedef struct segment_t {
+    size_t lh;
+    size_t q1;
+    size_t q2;
+    size_t rh;
+    size_t q3;
+    size_t q4;
+} segment_t;
+
+static inline void partition_array(size_t elements, segment_t *seg)
+{
+    size_t left = elements / 2;
+    size_t right = elements - left;
+    *seg = (segment_t) {
+        .lh = left,
+        .q1 = left / 2,
+        .q2 = left - (left / 2),
+        .rh = right,
+        .q3 = right / 2,
+        .q4 = right - (right / 2)
+    };
+}
+
+#endif
+
+#if !defined(XSORT_NAME) || !defined(XSORT_TYPE) || !defined(XSORT_LESS)
+    #error "XSORT_NAME, XSORT_TYPE and XSORT_LESS must be defined before including xsort_template.h"
+#endif
+
+static inline void XSORT_FN(rotate)(XSORT_TYPE *restrict array, XSORT_TYPE *restrict swap, size_t left, size_t right)
+{
+    XSORT_STAT_ADD(moved_bytes, (2 * left + right) * sizeof(XSORT_TYPE));
+    memcpy(&swap[0], &array[0], left * sizeof(XSORT_TYPE));
+    memmove(&array[0], &array[left], right * sizeof(XSORT_TYPE));
+    memcpy(&array[right], &swap[0], left * sizeof(XSORT_TYPE));
+}
+
+// Conditionally swap `seg[0]` and `seg[1]` without branching
+static inline bool XSORT_FN(xchg)(XSORT_TYPE *seg, __unused void *arg)
+{
+    bool res = XSORT_LT(&seg[1], &seg[0], arg);
+    XSORT_TYPE swap = seg[!res];
+    seg[0] = seg[res];
+    seg[1] = swap;
+    return res;
+}
+
+static void XSORT_FN(oddeven_sort)(XSORT_TYPE *restrict seg, size_t elements, void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_LEAF);
+    XSORT_TYPE *pair;
+    switch (elements) {
+        default: {
+            // Alternate between even and odd iterations
+            bool z = true;
+            uint8_t itr = 1;
+            // Current element being compared, starting from the third last element
+            XSORT_TYPE *elem = &seg[elements - 3]; // 4, 5, 6, 7 => 1, 2, 3, 4,
+            do {
+                // Set pair to point to the adjacent element based on the current iteration (even or odd)
+                pair = &elem[(z = !z)];
+                do {
+                    // Compare and swap adjacent elements if necessary, update itr accordingly
+                    itr |= XSORT_FN(xchg)(pair, arg);
+                    // Move to the previous pair of elements
+                    pair = &pair[-2];
+                } while (pair >= seg);
+            } while (itr-- && --elements);
+            return;
+        }
+        case 3:
+            // Compare and swap the first two elements if necessary
+            pair = &seg[0];
+            XSORT_FN(xchg)(pair, arg);
+            // Move to the next pair of elements and compare and swap if necessary
+            pair = &pair[1];
+            if (!XSORT_FN(xchg)(pair, arg)) {
+                return;
+            }
+            // fallthrough
+        case 2:
+            pair = &seg[0];
+            XSORT_FN(xchg)(pair, arg);
+            // fallthrough
+        case 1:
+        case 0:
+            return;
+    }
+}
+
+// Merge the two subarrays within `src` into `dst`.
+// The left subarray spans `&src[0]` to `src[left - 1]`, while the
+// right subarray spans `&src[left]` to `&src[left + right - 1]`.
+static __unused void XSORT_FN(parity_merge)(XSORT_TYPE *restrict src, XSORT_TYPE *restrict dst, size_t left, size_t right, __unused void *arg)
+{
+    const size_t n = left + right;
+    size_t i_ptd = 0;
+    size_t i_tpd = n - 1;
+
+    size_t i_ptl = 0;
+    size_t i_ptr = left;
+
+    if (left < right) {
+        dst[i_ptd++] = !XSORT_LT(&src[i_ptr], &src[i_ptl], arg) ? src[i_ptl++] : src[i_ptr++];
+    }
+
+    size_t i_tpl = left - 1;
+    size_t i_tpr = left + right - 1;
+
+    // Prefetch only while every address stays inside `src`; the final
+    // stretch near either end is merged without
+    const size_t ahead = XSORT_PREFETCH_AHEAD / sizeof(XSORT_TYPE);
+    if (n * sizeof(XSORT_TYPE) >= XSORT_PREFETCH_MIN) {
+        for (; left > 1 && i_ptl + ahead < n && i_ptr + ahead < n && i_tpl >= ahead && i_tpr >= ahead; left--) {
+            XSORT_PREFETCH(&src[i_ptl + ahead]);
+            XSORT_PREFETCH(&src[i_ptr + ahead]);
+            XSORT_PREFETCH(&src[i_tpl - ahead]);
+            XSORT_PREFETCH(&src[i_tpr - ahead]);
+            dst[i_ptd++] = !XSORT_LT(&src[i_ptr], &src[i_ptl], arg) ? src[i_ptl++] : src[i_ptr++];
+            dst[i_tpd--] = XSORT_LT(&src[i_tpr], &src[i_tpl], arg) ? src[i_tpl--] : src[i_tpr--];
+        }
+    }
+    while (--left) {
+        dst[i_ptd++] = !XSORT_LT(&src[i_ptr], &src[i_ptl], arg) ? src[i_ptl++] : src[i_ptr++];
+        dst[i_tpd--] = XSORT_LT(&src[i_tpr], &src[i_tpl], arg) ? src[i_tpl--] : src[i_tpr--];
+    }
+
+    dst[i_tpd] = XSORT_LT(&src[i_tpr], &src[i_tpl], arg) ? src[i_tpl] : src[i_tpr];
+    dst[i_ptd] = !XSORT_LT(&src[i_ptr], &src[i_ptl], arg) ? src[i_ptl] : src[i_ptr];
+}
+
+#ifdef XSORT_GALLOP
+
+// Number of elements of `base[0, n)` that order at or before `*key`,
+// found by exponential then binary search from the start of `base`
+static size_t XSORT_FN(gallop_upper)(const XSORT_TYPE *key, const XSORT_TYPE *base, size_t n, __unused void *arg)
+{
+    size_t lo = 0;
+    size_t hi = 1;
+    while (hi <= n && !XSORT_LT(key, &base[hi - 1], arg)) {
+        lo = hi;
+        hi = 2 * hi + 1;
+    }
+    hi = hi <= n ? hi - 1 : n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (XSORT_LT(key, &base[mid], arg)) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// Number of elements of `base[0, n)` that order strictly before `*key`
+static size_t XSORT_FN(gallop_lower)(const XSORT_TYPE *key, const XSORT_TYPE *base, size_t n, __unused void *arg)
+{
+    size_t lo = 0;
+    size_t hi = 1;
+    while (hi <= n && XSORT_LT(&base[hi - 1], key, arg)) {
+        lo = hi;
+        hi = 2 * hi + 1;
+    }
+    hi = hi <= n ? hi - 1 : n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (XSORT_LT(&base[mid], key, arg)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Merge `l[0, nl)` and `r[0, nr)` into `dst`, taking from `l` on ties. Runs
+// one element at a time until a run has won `XSORT_MIN_GALLOP` times in a
+// row, then switches to locating whole blocks by exponential search for as
+// long as that keeps paying off. `dst` may overlap `r` provided it does not
+// start past it, which lets an adjacent right run be merged in place
+static void XSORT_FN(gallop_merge)(const XSORT_TYPE *l, size_t nl, XSORT_TYPE *r, size_t nr, XSORT_TYPE *dst, void *arg)
+{
+    size_t min_gallop = XSORT_MIN_GALLOP;
+
+    while (nl && nr) {
+        size_t wins_l = 0;
+        size_t wins_r = 0;
+        do {
+            if (XSORT_LT(r, l, arg)) {
+                *dst++ = *r++;
+                nr--;
+                wins_r++;
+                wins_l = 0;
+            }
+            else {
+                *dst++ = *l++;
+                nl--;
+                wins_l++;
+                wins_r = 0;
+            }
+        } while (nl && nr && wins_l < min_gallop && wins_r < min_gallop);
+
+        while (nl && nr) {
+            size_t k_l = XSORT_FN(gallop_upper)(r, l, nl, arg);
+            memcpy(dst, l, k_l * sizeof(XSORT_TYPE));
+            dst += k_l;
+            l += k_l;
+            nl -= k_l;
+            if (!nl) {
+                break;
+            }
+            *dst++ = *r++;
+            if (!--nr) {
+                break;
+            }
+
+            size_t k_r = XSORT_FN(gallop_lower)(l, r, nr, arg);
+            memmove(dst, r, k_r * sizeof(XSORT_TYPE));
+            dst += k_r;
+            r += k_r;
+            nr -= k_r;
+            if (!nr) {
+                break;
+            }
+            *dst++ = *l++;
+            if (!--nl) {
+                break;
+            }
+
+            // Galloping is cheaper the longer it is sustained, so make it
+            // easier to re-enter after a productive stretch
+            if (k_l < XSORT_MIN_GALLOP && k_r < XSORT_MIN_GALLOP) {
+                min_gallop += 2;
+                break;
+            }
+            if (min_gallop > 1) {
+                min_gallop--;
+            }
+        }
+    }
+
+    memcpy(dst, l, nl * sizeof(XSORT_TYPE));
+    if (dst != r) {
+        memmove(&dst[nl], r, nr * sizeof(XSORT_TYPE));
+    }
+}
+
+#endif
+
+static inline void XSORT_FN(merge_halves)(XSORT_TYPE *restrict src, XSORT_TYPE *restrict dst, size_t left, size_t right, void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_MERGE);
+#ifdef XSORT_MERGE
+    if (XSORT_MERGE(src, dst, left, right, arg)) {
+        return;
+    }
+#endif
+#ifdef XSORT_GALLOP
+    XSORT_FN(gallop_merge)(&src[0], left, &src[left], right, dst, arg);
+#else
+    XSORT_FN(parity_merge)(src, dst, left, right, arg);
+#endif
+}
+
+// Merge the sorted runs `left` and `right` of arbitrary lengths into `dst`,
+// taking from `left` on ties
+static __unused void XSORT_FN(merge)(const XSORT_TYPE *restrict left, size_t nl, const XSORT_TYPE *restrict right, size_t nr, XSORT_TYPE *restrict dst, __unused void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_MERGE);
+    const XSORT_TYPE *end_l = &left[nl];
+    const XSORT_TYPE *end_r = &right[nr];
+
+    while (left < end_l && right < end_r) {
+        bool take_right = XSORT_LT(right, left, arg);
+        *dst++ = take_right ? *right : *left;
+        right += take_right;
+        left += !take_right;
+    }
+
+    memcpy(dst, left, (size_t)(end_l - left) * sizeof(XSORT_TYPE));
+    dst += end_l - left;
+    memcpy(dst, right, (size_t)(end_r - right) * sizeof(XSORT_TYPE));
+}
+
+// Number of elements of `left` among the first `rank` elements produced by
+// merging the sorted runs `left` and `right`, found by bisecting the
+// merge path along the diagonal `i + j = rank`
+static __unused size_t XSORT_FN(corank)(size_t rank, const XSORT_TYPE *left, size_t nl, const XSORT_TYPE *right, size_t nr, __unused void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_MERGE);
+    size_t lo = rank > nr ? rank - nr : 0;
+    size_t hi = rank < nl ? rank : nl;
+
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        if (!XSORT_LT(&right[rank - i - 1], &left[i], arg)) {
+            lo = i + 1;
+        }
+        else {
+            hi = i;
+        }
+    }
+    return lo;
+}
+
+static inline void XSORT_FN(reverse)(XSORT_TYPE *data, size_t elements)
+{
+    for (size_t i = 0, j = elements - 1; i < j; i++, j--) {
+        XSORT_TYPE tmp = data[i];
+        data[i] = data[j];
+        data[j] = tmp;
+    }
+}
+
+// Length of the run starting at `data[0]`: either non-descending, or
+// strictly descending in which case the run is reversed in place. Strict
+// descent is required so that reversing never reorders equal elements
+static size_t XSORT_FN(find_run)(XSORT_TYPE *data, size_t elements, bool reverse, __unused void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_RUNS);
+    size_t i = 1;
+    if (i < elements && XSORT_LT(&data[i], &data[i - 1], arg)) {
+        while (++i < elements && XSORT_LT(&data[i], &data[i - 1], arg));
+        if (reverse) {
+            XSORT_FN(reverse)(data, i);
+        }
+        return i;
+    }
+    while (i < elements && !XSORT_LT(&data[i], &data[i - 1], arg)) {
+        i++;
+    }
+    return i;
+}
+
+// Merge the adjacent sorted runs `data[0, left)` and `data[left, left + right)`,
+// buffering the shorter of the two in `swap`
+static void XSORT_FN(merge_buffered)(XSORT_TYPE *data, size_t left, size_t right, XSORT_TYPE *restrict swap, __unused void *arg)
+{
+    if (left <= right) {
+        memcpy(swap, data, left * sizeof(XSORT_TYPE));
+        XSORT_TYPE *l = swap, *end_l = &swap[left];
+        XSORT_TYPE *r = &data[left], *end_r = &data[left + right];
+        XSORT_TYPE *dst = data;
+        while (l < end_l && r < end_r) {
+            bool take_right = XSORT_LT(r, l, arg);
+            *dst++ = take_right ? *r : *l;
+            r += take_right;
+            l += !take_right;
+        }
+        memcpy(dst, l, (size_t)(end_l - l) * sizeof(XSORT_TYPE));
+    }
+    else {
+        memcpy(swap, &data[left], right * sizeof(XSORT_TYPE));
+        XSORT_TYPE *l = &data[left], *r = &swap[right];
+        XSORT_TYPE *dst = &data[left + right];
+        while (l > data && r > swap) {
+            bool take_left = XSORT_LT(&r[-1], &l[-1], arg);
+            *--dst = take_left ? l[-1] : r[-1];
+            l -= take_left;
+            r -= !take_left;
+        }
+        memcpy(data, swap, (size_t)(r - swap) * sizeof(XSORT_TYPE));
+    }
+}
+
+// Merge the adjacent sorted runs `data[0, left)` and `data[left, left + right)`
+// through `swap`, which only needs to hold the shorter of the two runs, or
+// the left run when `XSORT_GALLOP` is defined
+static void XSORT_FN(merge_adjacent)(XSORT_TYPE *data, size_t left, size_t right, XSORT_TYPE *restrict swap, __unused void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_MERGE);
+    if (!XSORT_LT(&data[left], &data[left - 1], arg)) {
+        return;
+    }
+
+#ifdef XSORT_GALLOP
+    // Leading elements of the left run and trailing elements of the
+    // right run that are already in their final position stay put
+    size_t skip = XSORT_FN(gallop_upper)(&data[left], data, left, arg);
+    data += skip;
+    left -= skip;
+    right = XSORT_FN(gallop_lower)(&data[left - 1], &data[left], right, arg);
+
+    memcpy(swap, data, left * sizeof(XSORT_TYPE));
+    XSORT_FN(gallop_merge)(swap, left, &data[left], right, data, arg);
+#else
+    XSORT_FN(merge_buffered)(data, left, right, swap, arg);
+#endif
+}
+
+// Sort `elements` elements of `ptr` using `swap`, which must be able to
+// hold `elements` elements, as scratch space
+static void XSORT_FN(quad_sort)(XSORT_TYPE *ptr, size_t elements, XSORT_TYPE *restrict swap, void *arg)
+{
+    // A segment's quarters are recomputed on resumption rather than stored
+    typedef struct stack_frame_t {
+        XSORT_TYPE *data;
+        size_t elements;
+        xsort_resume_t resume;
+    } stack_frame_t;
+
+    XSORT_TYPE *data = ptr;
+
+#ifdef XSORT_LEAF
+    const size_t leaf_max = XSORT_LEAF_MAX;
+#endif
+
+    ptrdiff_t stack_depth = 0;
+    stack_frame_t stk[XSORT_STACK_FRAMES];
+
+    stk[stack_depth] = (stack_frame_t) {
+        .data = data,
+        .elements = elements,
+        .resume = XSORT_RESUME(0),
+    };
+
+    while (stack_depth >= 0) {
+        stack_frame_t stk_top = stk[stack_depth--];
+        data = stk_top.data;
+        elements = stk_top.elements;
+        segment_t segment;
+#ifdef XSORT_COMPUTED_GOTO
+        goto *stk_top.resume;
+#else
+        switch (stk_top.resume) {
+            case 1:
+                goto ret_addr_1;
+            case 2:
+                goto ret_addr_2;
+            case 3:
+                goto ret_addr_3;
+            case 4:
+                goto ret_addr_4;
+            default:
+                goto ret_addr_0;
+        }
+#endif
+
+ret_addr_0:
+#ifdef XSORT_LEAF
+        if (elements && elements <= leaf_max) {
+            XSORT_STAT_TIMER_BEGIN();
+            XSORT_LEAF(data, elements, arg);
+            XSORT_STAT_TIMER_END(XSORT_PHASE_LEAF);
+            XSORT_STAT_ADD(leaf_kernels, 1);
+            continue;
+        }
+#endif
+        if (elements <= 7) {
+            XSORT_STAT_TIMER_BEGIN();
+            XSORT_FN(oddeven_sort)(data, elements, arg);
+            XSORT_STAT_TIMER_END(XSORT_PHASE_LEAF);
+            continue;
+        }
+
+        partition_array(elements, &segment);
+
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[0],
+            .elements = elements,
+            .resume = XSORT_RESUME(1)
+        };
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[0],
+            .elements = segment.q1,
+            .resume = XSORT_RESUME(0)
+        };
+        continue;
+ret_addr_1:
+        partition_array(elements, &segment);
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[0],
+            .elements = elements,
+            .resume = XSORT_RESUME(2)
+        };
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[segment.q1],
+            .elements = segment.q2,
+            .resume = XSORT_RESUME(0)
+        };
+        continue;
+ret_addr_2:
+        partition_array(elements, &segment);
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[0],
+            .elements = elements,
+            .resume = XSORT_RESUME(3)
+        };
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[segment.lh],
+            .elements = segment.q3,
+            .resume = XSORT_RESUME(0)
+        };
+        continue;
+ret_addr_3:
+        partition_array(elements, &segment);
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[0],
+            .elements = elements,
+            .resume = XSORT_RESUME(4)
+        };
+        stk[++stack_depth] = (stack_frame_t) {
+            .data = &data[segment.lh + segment.q3],
+            .elements = segment.q4,
+            .resume = XSORT_RESUME(0)
+        };
+        continue;
+ret_addr_4:
+        partition_array(elements, &segment);
+        XSORT_STAT_PHASE(XSORT_PHASE_PRESORT);
+        if (!XSORT_LT(&data[segment.q1], &data[segment.q1 - 1], arg)) {
+            if (!XSORT_LT(&data[segment.lh], &data[segment.lh - 1], arg)) {
+                if (!XSORT_LT(&data[segment.lh + segment.q3], &data[segment.lh + segment.q3 - 1], arg)) {
+                    XSORT_STAT_ADD(sorted_skips, 1);
+                    continue;
+                }
+            }
+        }
+
+        if (XSORT_LT(&data[segment.lh - 1], &data[0], arg)) {
+            if (XSORT_LT(&data[segment.lh + segment.q3 - 1], &data[segment.q1], arg)) {
+                if (XSORT_LT(&data[elements - 1], &data[segment.lh], arg)) {
+                    XSORT_FN(rotate)(&data[0], &swap[0], segment.q1, segment.q2 + segment.rh);
+                    XSORT_FN(rotate)(&data[0], &swap[0], segment.q2, segment.rh);
+                    XSORT_FN(rotate)(&data[0], &swap[0], segment.q3, segment.q4);
+                    XSORT_STAT_ADD(reverse_rotations, 1);
+                    continue;
+                }
+            }
+        }
+
+        XSORT_STAT_TIMER_BEGIN();
+        XSORT_FN(merge_halves)(&data[0], &swap[0], segment.q1, segment.q2, arg);
+        XSORT_FN(merge_halves)(&data[segment.lh], &swap[segment.lh], segment.q3, segment.q4, arg);
+        XSORT_FN(merge_halves)(&swap[0], &data[0], segment.lh, segment.rh, arg);
+        XSORT_STAT_TIMER_END(XSORT_PHASE_MERGE);
+    }
+}
+
+// Count the runs `natural_sort()` would merge, giving up once more
+// than `limit` have been seen
+static size_t XSORT_FN(count_runs)(XSORT_TYPE *data, size_t elements, size_t limit, void *arg)
+{
+    size_t runs = 0;
+    for (size_t i = 0; i < elements && runs <= limit; runs++) {
+        size_t len = XSORT_FN(find_run)(&data[i], elements - i, false, arg);
+        if (len < XSORT_MIN_RUN) {
+            len = elements - i < XSORT_MIN_RUN ? elements - i : XSORT_MIN_RUN;
+        }
+        i += len;
+    }
+    return runs;
+}
+
+// Sort by merging the input's existing runs according to the powersort
+// policy, which is near-optimal for the distribution of run lengths and
+// costs O(n) comparisons when there are only a few. Returns false, leaving
+// the input untouched, if it has too many runs to be worthwhile
+static bool XSORT_FN(natural_sort)(XSORT_TYPE *data, size_t elements, XSORT_TYPE *restrict swap, void *arg)
+{
+    XSORT_STAT_TIMER_BEGIN();
+    size_t runs = XSORT_FN(count_runs)(data, elements, elements / XSORT_NATURAL_RUN_AVG, arg);
+    XSORT_STAT_TIMER_END(XSORT_PHASE_RUNS);
+    if (runs > elements / XSORT_NATURAL_RUN_AVG) {
+        return false;
+    }
+    XSORT_STAT_ADD(natural_sorts, 1);
+
+    // A single run spanning the input is either sorted or strictly descending
+    if (runs == 1) {
+        if (XSORT_LT(&data[1], &data[0], arg)) {
+            XSORT_FN(reverse)(data, elements);
+        }
+        return true;
+    }
+
+    size_t start[XSORT_RUN_STACK];
+    size_t len[XSORT_RUN_STACK];
+    unsigned power[XSORT_RUN_STACK];
+    size_t top = 0;
+
+    for (size_t i = 0; i < elements;) {
+        XSORT_STAT_TIMER_BEGIN();
+        size_t n = XSORT_FN(find_run)(&data[i], elements - i, true, arg);
+        XSORT_STAT_TIMER_END(XSORT_PHASE_RUNS);
+        if (n < XSORT_MIN_RUN) {
+            n = elements - i < XSORT_MIN_RUN ? elements - i : XSORT_MIN_RUN;
+            XSORT_FN(quad_sort)(&data[i], n, swap, arg);
+        }
+
+        if (top) {
+            unsigned p = run_power(start[top - 1], len[top - 1], n, elements);
+            while (top > 1 && power[top - 2] > p) {
+                XSORT_STAT_TIMER_BEGIN();
+                XSORT_FN(merge_adjacent)(&data[start[top - 2]], len[top - 2], len[top - 1], swap, arg);
+                XSORT_STAT_TIMER_END(XSORT_PHASE_MERGE);
+                len[top - 2] += len[top - 1];
+                top--;
+            }
+            power[top - 1] = p;
+        }
+        start[top] = i;
+        len[top] = n;
+        top++;
+        i += n;
+    }
+
+    for (; top > 1; top--) {
+        XSORT_STAT_TIMER_BEGIN();
+        XSORT_FN(merge_adjacent)(&data[start[top - 2]], len[top - 2], len[top - 1], swap, arg);
+        XSORT_STAT_TIMER_END(XSORT_PHASE_MERGE);
+        len[top - 2] += len[top - 1];
+    }
+    return true;
+}
+
+// Less-than between two heads of a k-way merge, in the form the loser
+// tree of xsort_merge.h takes, which only tests for a negative result
+static ptrdiff_t XSORT_FN(kway_less)(const void *a, const void *b, __unused void *arg)
+{
+    return -(ptrdiff_t)XSORT_LT((const XSORT_TYPE *)a, (const XSORT_TYPE *)b, arg);
+}
+
+// Merge the `k` consecutive sorted runs `src[bounds[i], bounds[i + 1])`,
+// with `k` from 1 to `XSORT_MAX_FAN_IN`, into `dst` through a loser tree
+// kept on the stack, taking from the earlier run on ties. Every output
+// element costs about log2(k) comparisons but only a single pass over
+// memory. The last run left is copied out without the tree
+static void XSORT_FN(kway_merge)(const XSORT_TYPE *src, const size_t *bounds, size_t k, XSORT_TYPE *restrict dst, void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_MERGE);
+    const void *head[XSORT_MAX_FAN_IN];
+    const XSORT_TYPE *end[XSORT_MAX_FAN_IN];
+    size_t node[XSORT_MAX_FAN_IN];
+    size_t winner[2 * XSORT_MAX_FAN_IN];
+
+    size_t live = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (bounds[i] < bounds[i + 1]) {
+            head[live] = &src[bounds[i]];
+            end[live++] = &src[bounds[i + 1]];
+        }
+    }
+    if (!live) {
+        return;
+    }
+
+    loser_tree_t lt;
+    loser_tree_build(&lt, head, node, winner, live, XSORT_FN(kway_less), arg);
+    for (size_t runs = live; runs > 1;) {
+        size_t top = loser_tree_top(&lt);
+        const XSORT_TYPE *next = head[top];
+        *dst++ = *next++;
+        if (next == end[top]) {
+            next = NULL;
+            runs--;
+        }
+        head[top] = next;
+        loser_tree_replay(&lt);
+    }
+
+    size_t top = loser_tree_top(&lt);
+    const XSORT_TYPE *rest = head[top];
+    memcpy(dst, rest, (size_t)(end[top] - rest) * sizeof(XSORT_TYPE));
+}
+
+// Cache-blocked schedule for inputs much larger than the L2 cache. Blocks
+// sized so that a block and its scratch fit in L2 are sorted completely
+// in turn, then merged `fan_in` at a time, with `fan_in` chosen so that a
+// cache line of every run's head fits in L1. Each merge pass replaces
+// log2(fan_in) levels of pairwise merging over the whole array. Returns
+// false, without touching the input, if it is too small to benefit
+static bool XSORT_FN(blocked_sort)(XSORT_TYPE *ptr, size_t elements, XSORT_TYPE *restrict swap, void *arg)
+{
+    const xsort_cache_t *cache = xsort_cache();
+    size_t block = cache->l2 / (2 * sizeof(XSORT_TYPE));
+    size_t fan_in = cache->l1 / (2 * XSORT_CACHE_LINE);
+    fan_in = fan_in < XSORT_MAX_FAN_IN ? fan_in : XSORT_MAX_FAN_IN;
+    if (!block || fan_in < 4 || elements / 4 < block) {
+        return false;
+    }
+
+    for (size_t i = 0; i < elements; i += block) {
+        XSORT_FN(quad_sort)(&ptr[i], elements - i < block ? elements - i : block, swap, arg);
+    }
+
+    // Runs start at every multiple of `width`; each pass merges groups of
+    // `fan_in` of them, alternating between `ptr` and `swap`
+    size_t bounds[XSORT_MAX_FAN_IN + 1];
+    XSORT_TYPE *src = ptr;
+    XSORT_TYPE *dst = swap;
+    for (size_t width = block; width < elements; width = width > elements / fan_in ? elements : width * fan_in) {
+        XSORT_STAT_TIMER_BEGIN();
+        for (size_t base = 0; base < elements; base += width * fan_in) {
+            size_t k = 0;
+            for (size_t start = base; k < fan_in && start < elements; start += width) {
+                bounds[k++] = start;
+            }
+            size_t stop = elements - base > width * fan_in ? base + width * fan_in : elements;
+            bounds[k] = stop;
+            XSORT_FN(kway_merge)(src, bounds, k, &dst[base], arg);
+        }
+        XSORT_STAT_TIMER_END(XSORT_PHASE_MERGE);
+        XSORT_TYPE *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != ptr) {
+        memcpy(ptr, src, elements * sizeof(XSORT_TYPE));
+    }
+    return true;
+}
+
+// Sort `elements` elements of `ptr` using `swap`, which must be able to
+// hold `elements` elements, as scratch space. Inputs made up of a few long
+// runs, ascending or strictly descending, are merged as they stand
+static void XSORT_NAME(XSORT_TYPE *ptr, size_t elements, XSORT_TYPE *restrict swap, void *arg)
+{
+    if (elements < 2 * XSORT_NATURAL_RUN_AVG || !XSORT_FN(natural_sort)(ptr, elements, swap, arg)) {
+        XSORT_FN(quad_sort)(ptr, elements, swap, arg);
+    }
+}
+
+// Same as the main entry point, but inputs far larger than the L2 cache
+// follow the cache-blocked schedule
+static __unused void XSORT_FN(blocked)(XSORT_TYPE *ptr, size_t elements, XSORT_TYPE *restrict swap, void *arg)
+{
+    if (elements >= 2 * XSORT_NATURAL_RUN_AVG && XSORT_FN(natural_sort)(ptr, elements, swap, arg)) {
+        return;
+    }
+    if (!XSORT_FN(blocked_sort)(ptr, elements, swap, arg)) {
+        XSORT_FN(quad_sort)(ptr, elements, swap, arg);
+    }
+}
+
+static size_t XSORT_FN(upper_bound)(const XSORT_TYPE *key, const XSORT_TYPE *base, size_t n, __unused void *arg)
+{
+    size_t lo = 0;
+    while (n) {
+        size_t half = n / 2;
+        if (!XSORT_LT(key, &base[lo + half], arg)) {
+            lo += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+// Number of elements of `base[0, n)` that order strictly before `*key`
+static size_t XSORT_FN(lower_bound)(const XSORT_TYPE *key, const XSORT_TYPE *base, size_t n, __unused void *arg)
+{
+    size_t lo = 0;
+    while (n) {
+        size_t half = n / 2;
+        if (XSORT_LT(&base[lo + half], key, arg)) {
+            lo += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+// Exchange the adjacent blocks `array[0, left)` and `array[left, left + right)`,
+// moving through `buf` when either block fits in its `cap` elements and
+// by triple reversal otherwise
+static void XSORT_FN(rotate_bounded)(XSORT_TYPE *array, size_t left, size_t right, XSORT_TYPE *restrict buf, size_t cap)
+{
+    if (!left || !right) {
+        return;
+    }
+    if (left <= cap) {
+        XSORT_FN(rotate)(array, buf, left, right);
+    }
+    else if (right <= cap) {
+        XSORT_STAT_ADD(moved_bytes, (2 * right + left) * sizeof(XSORT_TYPE));
+        memcpy(&buf[0], &array[left], right * sizeof(XSORT_TYPE));
+        memmove(&array[right], &array[0], left * sizeof(XSORT_TYPE));
+        memcpy(&array[0], &buf[0], right * sizeof(XSORT_TYPE));
+    }
+    else {
+        XSORT_STAT_ADD(moved_bytes, 2 * (left + right) * sizeof(XSORT_TYPE));
+        XSORT_FN(reverse)(&array[0], left);
+        XSORT_FN(reverse)(&array[left], right);
+        XSORT_FN(reverse)(&array[0], left + right);
+    }
+}
+
+// Stable merge of the adjacent runs `data[0, left)` and `data[left, left + right)`
+// using at most `cap` elements of `buf`. Once the shorter run fits it is
+// merged through `buf`; until then the longer run is cut at its midpoint,
+// the matching cut in the other run is found by binary search, and the
+// blocks between the two cuts are rotated past each other, leaving two
+// smaller independent merges
+static void XSORT_FN(merge_inplace)(XSORT_TYPE *data, size_t left, size_t right, XSORT_TYPE *restrict buf, size_t cap, void *arg)
+{
+    XSORT_STAT_PHASE(XSORT_PHASE_MERGE);
+    while (left && right && XSORT_LT(&data[left], &data[left - 1], arg)) {
+        if (left <= cap || right <= cap) {
+            XSORT_FN(merge_buffered)(data, left, right, buf, arg);
+            return;
+        }
+
+        // `data[0, i)` and `data[left, left + j)` precede everything else
+        size_t i, j;
+        if (left >= right) {
+            i = left / 2;
+            j = XSORT_FN(lower_bound)(&data[i], &data[left], right, arg);
+        }
+        else {
+            j = right / 2;
+            i = XSORT_FN(upper_bound)(&data[left + j], data, left, arg);
+        }
+        XSORT_FN(rotate_bounded)(&data[i], left - i, j, buf, cap);
+
+        // Recurse into the smaller half so the depth stays logarithmic
+        if (i + j <= left + right - i - j) {
+            XSORT_FN(merge_inplace)(data, i, j, buf, cap, arg);
+            data += i + j;
+            left -= i;
+            right -= j;
+        }
+        else {
+            XSORT_FN(merge_inplace)(&data[i + j], left - i, right - j, buf, cap, arg);
+            left = i;
+            right = j;
+        }
+    }
+}
+
+// Sort `elements` elements of `ptr` with a scratch buffer `buf` of only
+// `cap` elements, at least one. Blocks of `cap` elements are sorted by the
+// regular engine, then merged pairwise in place
+static __unused void XSORT_FN(lowmem)(XSORT_TYPE *ptr, size_t elements, XSORT_TYPE *restrict buf, size_t cap, void *arg)
+{
+    if (elements <= cap) {
+        XSORT_NAME(ptr, elements, buf, arg);
+        return;
+    }
+
+    for (size_t i = 0; i < elements; i += cap) {
+        XSORT_NAME(&ptr[i], elements - i < cap ? elements - i : cap, buf, arg);
+    }
+    for (size_t width = cap; width < elements; width *= 2) {
+        for (size_t i = 0; i + width < elements; i += 2 * width) {
+            size_t right = elements - i - width < width ? elements - i - width : width;
+            XSORT_STAT_TIMER_BEGIN();
+            XSORT_FN(merge_inplace)(&ptr[i], width, right, buf, cap, arg);
+            XSORT_STAT_TIMER_END(XSORT_PHASE_MERGE);
+        }
+    }
+}
+
+#undef XSORT_NAME
+#undef XSORT_TYPE
+#undef XSORT_LESS
+#undef XSORT_LEAF
+#undef XSORT_LEAF_MAX
+#undef XSORT_MERGE
+#undef XSORT_GALLOP